@@ -3,14 +3,213 @@
 
 #include <functional>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
+#include <exception>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <thread>
+#include <vector>
+
+// Binary (de)serialization of keys for ADS_set::save()/load(). Trivially
+// copyable keys are written as raw bytes, a whole bucket at a time; other key
+// types need a specialization with the same two functions. read() constructs
+// exactly n keys in uninitialized storage, also if the stream fails.
+template<typename Key, typename Enable = void>
+struct ADS_serializer;
+
+template<typename Key>
+struct ADS_serializer<Key, typename std::enable_if<std::is_trivially_copyable<Key>::value>::type> {
+    static void write(std::ostream& o, const Key* keys, size_t n) {
+        o.write(reinterpret_cast<const char*>(keys), std::streamsize(n * sizeof(Key)));
+    }
+
+    static void read(std::istream& i, Key* keys, size_t n) {
+        i.read(reinterpret_cast<char*>(keys), std::streamsize(n * sizeof(Key)));
+    }
+};
+
+template<>
+struct ADS_serializer<std::string> {
+    static void write(std::ostream& o, const std::string* keys, size_t n) {
+        for (size_t j = 0; j < n; ++j) {
+            uint64_t length = keys[j].size();
+            o.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            o.write(keys[j].data(), std::streamsize(length));
+        }
+    }
+
+    static void read(std::istream& i, std::string* keys, size_t n) {
+        size_t j = 0;
+        try {
+            for (; j < n; ++j) {
+                uint64_t length = 0;
+                if (!i.read(reinterpret_cast<char*>(&length), sizeof(length))) length = 0;
+                ::new (keys + j) std::string();
+                // in pieces, so that a corrupt length runs into the end of the
+                // stream instead of allocating all of it
+                for (uint64_t done = 0; done < length && i;) {
+                    size_t piece = size_t(std::min<uint64_t>(length - done, 65536));
+                    keys[j].resize(size_t(done) + piece);
+                    i.read(&keys[j][size_t(done)], std::streamsize(piece));
+                    done += piece;
+                }
+            }
+        } catch (...) {
+            while (j) keys[--j].~basic_string();
+            throw;
+        }
+    }
+};
+
+// Split triggers of ADS_set, chosen with ADS_split_layout.
+//
+// on_load: split when an insert raises the load factor above its maximum.
+// chain_limit: split when an insert finds the chain of its slot with this
+// many buckets, all of them full; 0 never. Either way one split is done, of
+// slot nextToSplit_ as always, and the insert then proceeds.
+struct ADS_load_factor_split {
+    static const bool on_load = true;
+    static const size_t chain_limit = 0;
+};
+
+// Litwin's uncontrolled splitting: each insert that needs a new overflow
+// bucket causes a split, whatever the load factor
+struct ADS_overflow_split {
+    static const bool on_load = false;
+    static const size_t chain_limit = 1;
+};
+
+// Load factor control, plus a split whenever a chain is about to grow
+// beyond MaxBuckets buckets
+template<size_t MaxBuckets = 2>
+struct ADS_chain_split {
+    static_assert(MaxBuckets > 0, "chains have at least one bucket");
+    static const bool on_load = true;
+    static const size_t chain_limit = MaxBuckets;
+};
+
+// Bucket layout of ADS_set
+struct ADS_default_layout {
+    // alignment of every bucket in bytes, 0 keeps the natural alignment
+    static const size_t alignment = 0;
+    // compact buckets: 8/16 bit fill count and a 32 bit pool index instead
+    // of size_t and an overflow pointer; buckets are allocated from a pool
+    static const bool compact = false;
+    static const bool sorted = false;
+    static const bool filter = false;
+    // sets of at most N keys keep them in one bucket inside the set object
+    // if a bucket takes no more than inlineBytes; 0 always allocates
+    static const size_t inlineBytes = 256;
+    static const bool deamortized = false;
+    static const bool deferred = false;
+    // Larson's partial expansions: the directory doubles in two steps,
+    // groups of two slots growing to three and then four
+    static const bool partial = false;
+    // spiral storage: exponential addressing, the fullest slot splits next
+    static const bool spiral = false;
+    using split = ADS_load_factor_split;
+};
+
+struct ADS_compact_layout: ADS_default_layout {
+    static const bool compact = true;
+};
+
+// Base with every bucket kept sorted by key_compare: lookups binary search a
+// bucket instead of scanning it, which pays off for large N. Needs operator<.
+template<typename Base = ADS_default_layout>
+struct ADS_sorted_layout: Base {
+    static const bool sorted = true;
+};
+
+// Base with a blocked Bloom filter per slot, so most lookups of absent keys
+// return without touching the bucket chain. Erased keys leave their bits
+// behind until the slot is split or compact() runs.
+template<typename Base = ADS_default_layout>
+struct ADS_filter_layout: Base {
+    static const bool filter = true;
+};
 
-template<typename Key, size_t N = 3>
+// Base whose directory doubling is spread over the splits of a round: the
+// directory of the next round is allocated when a round starts and two slots
+// are copied per split, so no insert copies the whole directory.
+template<typename Base = ADS_default_layout>
+struct ADS_deamortized_layout: Base {
+    static const bool deamortized = true;
+};
+
+// Base whose insert() leaves splits to maintain(), called from an idle loop
+// or a maintenance thread (see maintained_ads_set.h). Only at twice the
+// maximum load factor does insert() split by itself.
+template<typename Base = ADS_default_layout>
+struct ADS_deferred_layout: Base {
+    static const bool deferred = true;
+};
+
+// Base with partial expansions. Linear hashing leaves the unsplit half of a
+// round with twice the keys per slot of the split half; here slot g gets
+// slots g + G and g + 2G (G = 2^(d-1) groups) as partners and each step
+// spreads the keys of a group over one more slot, so slots differ by at most
+// 3:2 and chains stay shorter at the same memory. A split reads two or
+// three slots instead of one.
+template<typename Base = ADS_default_layout>
+struct ADS_partial_layout: Base {
+    static const bool partial = true;
+};
+
+// Base with spiral storage addressing instead of linear hashing. Keys are
+// spread over the slots with loads falling smoothly from 2 to 1, from the
+// slot split next to the one split last, instead of slots of a round
+// holding either one or two shares; no round ever leaves the directory
+// uniformly full. Lookups pay for an exp2().
+template<typename Base = ADS_default_layout>
+struct ADS_spiral_layout: Base {
+    static const bool spiral = true;
+};
+
+// Base with another split trigger, see ADS_load_factor_split
+template<typename Split, typename Base = ADS_default_layout>
+struct ADS_split_layout: Base {
+    using split = Split;
+};
+
+// Buckets aligned to Bytes (a power of two); together with ADS_fit for N a
+// bucket fills exactly one cache line (64), two (128) or a page (4096).
+template<size_t Bytes, bool Compact = false>
+struct ADS_fit_layout: ADS_default_layout {
+    static_assert(Bytes && !(Bytes & (Bytes - 1)), "bucket size must be a power of two");
+    static const size_t alignment = Bytes;
+    static const bool compact = Compact;
+};
+
+// Keys per bucket such that bucket header and keys fit into Bytes, at least one
+template<typename Key, size_t Bytes, bool Compact = false>
+struct ADS_fit {
+    static const size_t header = Compact
+            ? (sizeof(uint32_t) + sizeof(uint16_t) + alignof(Key) - 1) / alignof(Key) * alignof(Key)
+            : sizeof(size_t) + sizeof(void*);
+    static const size_t value = Bytes >= header + sizeof(Key) ? (Bytes - header) / sizeof(Key) : 1;
+};
+
+// Set of keys by linear hashing, Layout selects the bucket and directory
+// variants above. Inserts and erases may invalidate iterators. Unlike
+// std::set::swap(), swap() invalidates the iterators of a set of at most N
+// keys held in its inline bucket: the keys move into the other set's inline
+// bucket, and such an iterator then points at the keys the other set held.
+template<typename Key, size_t N = 3, typename Layout = ADS_default_layout>
 class ADS_set {
 public:
     class Iterator;
+    class Node;
     using value_type = Key;
     using key_type = Key;
     using reference = key_type &;
@@ -22,194 +221,1081 @@ public:
     using key_compare = std::less<key_type>;   // B+-Tree
     using key_equal = std::equal_to<key_type>; // Hashing
     using hasher = std::hash<key_type>;        // Hashing
+    using node_type = Node;
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
     static const size_t SIZE_INVALID = (size_t) -1;
 private:
-    struct Bucket {
-        Key keys[N];
-        size_t nextFreeIndex{0};
-        Bucket* overflowBucket{nullptr};
+    static_assert(!Layout::compact || N <= 0xffff, "compact buckets hold at most 65535 keys");
+    static_assert(!Layout::partial || !Layout::spiral, "partial expansions and spiral storage exclude each other");
+    // slot j of a larger directory only holds keys of slot addressOf(j)
+    static const bool linearSlots = !Layout::partial && !Layout::spiral;
+
+    struct Bucket;
+    using Compact = std::integral_constant<bool, Layout::compact>;
+    // trivially copyable keys are moved around as bytes
+    using Trivial = std::integral_constant<bool, std::is_trivially_copyable<Key>::value>;
+    using Sorted = std::integral_constant<bool, Layout::sorted>;
+    // reference to a bucket: pointer, or pool index (0 = none) if compact
+    using Link = typename std::conditional<Layout::compact, uint32_t, Bucket*>::type;
+    using Count = typename std::conditional<!Layout::compact, size_t,
+            typename std::conditional<(N < 256), uint8_t, uint16_t>::type>::type;
+
+    static const size_t naturalAlignment = alignof(Key) > alignof(Link) ? alignof(Key) : alignof(Link);
+    static const size_t bucketAlignment =
+            Layout::alignment > naturalAlignment ? Layout::alignment : naturalAlignment;
+
+    // Moves n keys from `from` to uninitialized `to` and ends the lifetime of
+    // the sources; the ranges may overlap if to < from.
+    static void relocate(Key* to, Key* from, size_t n) { relocate(to, from, n, Trivial{}); }
+
+    static void relocate(Key* to, Key* from, size_t n, std::true_type) {
+        if (n) std::memmove(static_cast<void*>(to), from, n * sizeof(Key));
+    }
+
+    static void relocate(Key* to, Key* from, size_t n, std::false_type) {
+        for (size_t i = 0; i < n; ++i) {
+            ::new (to + i) Key(std::move(from[i]));
+            from[i].~Key();
+        }
+    }
+
+    // header first, so the key array starts right behind it. keys[i] is
+    // constructed only for i < nextFreeIndex, so Key needs no default
+    // constructor and an empty bucket constructs nothing.
+    struct alignas(bucketAlignment) Bucket {
+        Link overflowBucket{};
+        Count nextFreeIndex{0};
+        union {
+            Key keys[N];
+        };
 
         Bucket() {}
 
+        Bucket(const Bucket& other): overflowBucket{other.overflowBucket} {
+            copy(other, Trivial{});
+            nextFreeIndex = other.nextFreeIndex;
+        }
+
+        void copy(const Bucket& other, std::true_type) {
+            std::memcpy(static_cast<void*>(keys), other.keys, other.nextFreeIndex * sizeof(Key));
+        }
+
+        void copy(const Bucket& other, std::false_type) {
+            std::uninitialized_copy(other.keys, other.keys + other.nextFreeIndex, keys);
+        }
+
+        Bucket& operator=(const Bucket&) = delete;
+
         ~Bucket() {
-            if (nullptr != overflowBucket) {
-                delete overflowBucket;
-                overflowBucket = nullptr;
+            for (size_t i = 0; i < nextFreeIndex; ++i) {
+                keys[i].~Key();
             }
         }
-    };
 
-    friend class PrivateBucketIterator;
-    class PrivateBucketIterator {
-    private:
-        Bucket** _table;
-        size_t _index;
-        size_t _size;
-    public:
-        using value_type = Bucket;
-        using reference = value_type &;
-        using pointer = value_type *;
-        using iterator_category = std::forward_iterator_tag;
+        void push(const Key& key) {
+            ::new (keys + nextFreeIndex) Key(key);
+            ++nextFreeIndex;
+        }
 
-        PrivateBucketIterator(Bucket** hashTable, size_t index, size_t size)
-                : _table{hashTable}, _index{index}, _size{size}
-        {}
+        void push(Key&& key) {
+            ::new (keys + nextFreeIndex) Key(std::move(key));
+            ++nextFreeIndex;
+        }
 
-        PrivateBucketIterator(const PrivateBucketIterator& other)
-                : PrivateBucketIterator(other._table, other._index, other._size)
-        {}
+        // Adds key at its place in a sorted bucket, at the end otherwise;
+        // returns its index
+        template<typename K>
+        size_t add(K&& key) { return add(std::forward<K>(key), Sorted{}); }
 
-        reference operator*() const
-        {
-            if(_index == SIZE_INVALID)
-                throw std::runtime_error("Table array exceeded");
+        template<typename K>
+        size_t add(K&& key, std::false_type) {
+            push(std::forward<K>(key));
+            return nextFreeIndex - 1;
+        }
 
-            Bucket* bucket = _table[_index];
+        template<typename K>
+        size_t add(K&& key, std::true_type) {
+            size_t i = size_t(std::lower_bound(keys, keys + nextFreeIndex, key, key_compare{}) - keys);
+            push(std::forward<K>(key));
+            std::rotate(keys + i, keys + nextFreeIndex - 1, keys + nextFreeIndex);
+            return i;
+        }
 
-            return *bucket;
-        };
+        // Index of key, SIZE_INVALID if it is not in this bucket
+        size_t indexOf(const Key& key) const { return indexOf(key, Sorted{}); }
 
-        pointer operator->() const
-        {
-            if(_index == SIZE_INVALID)
-                throw std::runtime_error("Table array exceeded");
+        size_t indexOf(const Key& key, std::false_type) const {
+            for (size_t i = 0; i < nextFreeIndex; ++i) {
+                if (key_equal{}(key, keys[i])) return i;
+            }
+            return SIZE_INVALID;
+        }
 
-            return _table[_index];
-        };
+        size_t indexOf(const Key& key, std::true_type) const {
+            size_t i = size_t(std::lower_bound(keys, keys + nextFreeIndex, key, key_compare{}) - keys);
+            if (i < nextFreeIndex && key_equal{}(key, keys[i])) return i;
+            return SIZE_INVALID;
+        }
 
-        PrivateBucketIterator& operator++()
-        {
-            if(_index == SIZE_INVALID)
-                throw std::runtime_error("Table array exceeded");
+        // Restores the order after keys were appended in bulk
+        void sort() { sort(Sorted{}); }
+        void sort(std::false_type) {}
+        void sort(std::true_type) { std::sort(keys, keys + nextFreeIndex, key_compare{}); }
 
-            if(++_index == _size)
-                _index = SIZE_INVALID;
+        void clear() {
+            for (size_t i = 0; i < nextFreeIndex; ++i) {
+                keys[i].~Key();
+            }
+            nextFreeIndex = 0;
+        }
 
-            return *this;
-        };
+        // Removes keys[i], the keys behind it move up one place
+        void remove(size_t i) {
+            keys[i].~Key();
+            relocate(keys + i, keys + i + 1, --nextFreeIndex - i);
+        }
 
-        PrivateBucketIterator operator++(int)
-        {
-            PrivateBucketIterator other {*this};
-            ++(*this);
-            return other;
-        };
+        // plain new only guarantees alignof(std::max_align_t)
+        static void* allocate(size_t size) {
+            if (alignof(Bucket) <= alignof(std::max_align_t)) return ::operator new(size);
 
-        friend bool operator==(const PrivateBucketIterator& me, const PrivateBucketIterator& other)
-        {
-            return me._table == other._table
-                   && me._index == other._index;
-        };
+            void* memory = nullptr;
+            if (posix_memalign(&memory, alignof(Bucket), size) != 0) throw std::bad_alloc();
+            return memory;
+        }
 
-        friend bool operator!=(const PrivateBucketIterator& me, const PrivateBucketIterator& other)
-        {
-            return !(me == other);
-        };
+        static void release(void* memory) noexcept {
+            if (alignof(Bucket) <= alignof(std::max_align_t))
+                ::operator delete(memory);
+            else
+                free(memory);
+        }
+
+        static void* operator new(size_t size) { return allocate(size); }
+        static void* operator new[](size_t size) { return allocate(size); }
+        static void operator delete(void* memory) noexcept { release(memory); }
+        static void operator delete[](void* memory) noexcept { release(memory); }
+    };
+
+    // Bucket storage of compact layouts. Chunk c holds 16 << c buckets, so
+    // buckets never move and an index maps to its chunk with one clz. Chunks
+    // are raw memory, buckets are constructed as they are handed out, so
+    // untouched pages stay unmapped. Index 0 is never handed out; buckets
+    // are only released all at once.
+    class Pool {
+        std::vector<Bucket*> chunks_;
+        uint32_t size_{1};
+
+        static size_t chunkOf(size_t position) { return size_t(59 - __builtin_clzll(position)); }
+
+        void grow() {
+            chunks_.push_back(nullptr);
+            try {
+                size_t n = size_t(16) << (chunks_.size() - 1);
+                chunks_.back() = static_cast<Bucket*>(Bucket::allocate(n * sizeof(Bucket)));
+            } catch (...) {
+                chunks_.pop_back();
+                throw;
+            }
+        }
+
+        void destroy() {
+            for (uint32_t i = 1; i < size_; ++i) {
+                (*this)[i]->~Bucket();
+            }
+            for (Bucket* chunk: chunks_) Bucket::release(chunk);
+            chunks_.clear();
+            size_ = 1;
+        }
+
+    public:
+        Pool() = default;
+        Pool(const Pool&) = delete;
+        Pool& operator=(const Pool&) = delete;
+
+        ~Pool() { destroy(); }
+
+        Bucket* operator[](uint32_t index) const {
+            size_t position = size_t(index) + 16;
+            size_t chunk = chunkOf(position);
+            return chunks_[chunk] + (position - (size_t(16) << chunk));
+        }
+
+        uint32_t allocate() {
+            if (0xffffffffu == size_) throw std::length_error("ADS_set bucket pool exhausted");
+            if (chunkOf(size_t(size_) + 16) == chunks_.size()) grow();
+            ::new ((*this)[size_]) Bucket();
+            return size_++;
+        }
+
+        // Copies the buckets of other to the same indices of this empty pool.
+        // Only copies that cannot throw are split across `threads`, a
+        // failing serial copy leaves size_ at the buckets to destroy.
+        void assign(const Pool& other, size_t threads) {
+            while (chunks_.size() < other.chunks_.size()) grow();
+            if (std::is_trivially_copyable<Key>::value) {
+                parallelFor(other.size_, threads, [this, &other](size_t first, size_t last) {
+                    for (size_t i = std::max<size_t>(first, 1); i < last; ++i) {
+                        ::new ((*this)[uint32_t(i)]) Bucket(*other[uint32_t(i)]);
+                    }
+                });
+                size_ = other.size_;
+            } else {
+                for (; size_ < other.size_; ++size_) {
+                    ::new ((*this)[size_]) Bucket(*other[size_]);
+                }
+            }
+        }
+
+        void swap(Pool& other) {
+            chunks_.swap(other.chunks_);
+            std::swap(size_, other.size_);
+        }
+    };
+
+    struct NoPool {
+        void swap(NoPool&) {}
     };
 
-    Bucket** table_{nullptr};
+    Link* table_{nullptr};
+    // empty buckets for reuse, linked through overflowBucket
+    Link spare_{};
+    typename std::conditional<Layout::compact, Pool, NoPool>::type pool_;
+    // bit i set <=> chain of slot i holds keys; sized like table_
+    uint64_t* occupied_{nullptr};
+    // filter layouts: filterWords words per slot, sized like table_
+    uint64_t* filter_{nullptr};
+    // deamortized layouts: the arrays above for the next round, twice as
+    // large; slots [0, copied_) are copied and kept up to date
+    Link* grownTable_{nullptr};
+    uint64_t* grownBits_{nullptr};
+    uint64_t* grownFilter_{nullptr};
+    size_t copied_{0};
     size_t tableSize_;
     size_t size_{0};
     size_t d_{2};
     size_t nextToSplit_{0};
     float maxLoadFactor_{0.9};
 
-    using bucketIterator = PrivateBucketIterator;
+    static size_t bitmapWords(size_t slots) { return (slots + 63) / 64; }
+
+    void markOccupied(size_t index, bool occupied) {
+        if (occupied)
+            occupied_[index / 64] |= uint64_t(1) << (index % 64);
+        else
+            occupied_[index / 64] &= ~(uint64_t(1) << (index % 64));
+        if (Layout::deamortized && index < copied_) {
+            uint64_t bit = uint64_t(1) << (index % 64);
+            grownBits_[index / 64] = (grownBits_[index / 64] & ~bit) | (occupied_[index / 64] & bit);
+        }
+    }
+
+    // First slot >= from with a non-empty chain, tableSize_ if there is none
+    size_t nextOccupied(size_t from) const {
+        size_t word = from / 64;
+        size_t words = bitmapWords(tableSize_);
+        if (word >= words) return tableSize_;
+
+        uint64_t bits = occupied_[word] & (~uint64_t(0) << (from % 64));
+        while (!bits) {
+            if (++word == words) return tableSize_;
+            bits = occupied_[word];
+        }
+        return word * 64 + __builtin_ctzll(bits);
+    }
+
+    Bucket* bucketAt(Link link) const { return bucketAt(link, Compact{}); }
+    Bucket* bucketAt(Link link, std::false_type) const { return link; }
+    Bucket* bucketAt(Link link, std::true_type) const { return link ? pool_[link] : nullptr; }
+
+    Bucket* head(size_t index) const { return bucketAt(table_[index]); }
+    Bucket* next(const Bucket* bucket) const { return bucketAt(bucket->overflowBucket); }
+
+    Link newBucket() {
+        if (!spare_) return allocateBucket(Compact{});
+        Link link = spare_;
+        Bucket* bucket = bucketAt(link);
+        spare_ = bucket->overflowBucket;
+        bucket->overflowBucket = Link{};
+        return link;
+    }
+    Link allocateBucket(std::true_type) { return pool_.allocate(); }
+    Link allocateBucket(std::false_type) { return new Bucket(); }
+
+    // Keeps an empty bucket, unlinked from its chain, for newBucket(); pool
+    // buckets cannot change hands and stay where they are
+    void recycle(Bucket* bucket) { recycle(bucket, Compact{}); }
+    void recycle(Bucket*, std::true_type) {}
+    void recycle(Bucket* bucket, std::false_type) {
+        bucket->overflowBucket = spare_;
+        spare_ = bucket;
+    }
+
+    // After merge() moved the keys of slots [0, failed) and some of slot
+    // failed out of this: gives the slots whose head bucket went to target
+    // one back, from target's spare buckets while it has some, and clears
+    // the occupied bits of the emptied slots
+    void restoreHeads(size_t failed, ADS_set& target) {
+        for (size_t i = 0; i <= failed && i < tableSize_; ++i) {
+            if (!table_[i]) {
+                if (!Layout::compact && target.spare_) {
+                    table_[i] = target.spare_;
+                    target.spare_ = head(i)->overflowBucket;
+                    head(i)->overflowBucket = Link{};
+                } else {
+                    table_[i] = newBucket();
+                }
+            }
+            if (Layout::deamortized && i < copied_) grownTable_[i] = table_[i];
+            markOccupied(i, chainSize(head(i)) != 0);
+        }
+    }
+
+    // Empties the chain of slot index; its overflow buckets become spare
+    void clearChain(size_t index) {
+        Bucket* bucket = head(index);
+        bucket->clear();
+        releaseAfter(bucket);
+    }
+
+    // Empties the buckets behind bucket in its chain and makes them spare
+    void releaseAfter(Bucket* bucket) {
+        Link overflow = bucket->overflowBucket;
+        bucket->overflowBucket = Link{};
+        if (!overflow) return;
+
+        for (bucket = bucketAt(overflow); ; bucket = next(bucket)) {
+            bucket->clear();
+            if (!bucket->overflowBucket) break;
+        }
+        bucket->overflowBucket = spare_;
+        spare_ = overflow;
+    }
+
+    // Appends an empty overflow bucket to bucket and returns it
+    Bucket* appendBucket(Bucket* bucket) {
+        bucket->overflowBucket = newBucket();
+        return next(bucket);
+    }
+
+    // Compact buckets go back with the pool
+    void releaseChain(Link link) { releaseChain(link, Compact{}); }
+    void releaseChain(Link, std::true_type) {}
+    void releaseChain(Link link, std::false_type) {
+        while (link) {
+            Bucket* next = link->overflowBucket;
+            delete link;
+            link = next;
+        }
+    }
+
+    // Blocked Bloom filter: a key sets three bits in one of the words of its
+    // slot, all taken from the high bits of its mixed hash (the slot address
+    // uses the low ones).
+    static const size_t filterWords = (N + 7) / 8;
+
+    static uint64_t filterMix(size_t hash) { return uint64_t(hash) * 0x9e3779b97f4a7c15ull; }
+
+    static uint64_t filterMask(uint64_t mixed) {
+        return uint64_t(1) << (mixed >> 58) | uint64_t(1) << ((mixed >> 52) & 63)
+               | uint64_t(1) << ((mixed >> 46) & 63);
+    }
+
+    uint64_t& filterWord(size_t index, uint64_t mixed) const {
+        return filter_[index * filterWords + (mixed >> 32) % filterWords];
+    }
+
+    bool mayContain(size_t index, size_t hash) const {
+        if (!Layout::filter) return true;
+        uint64_t mixed = filterMix(hash);
+        uint64_t mask = filterMask(mixed);
+        return (filterWord(index, mixed) & mask) == mask;
+    }
+
+    void addToFilter(size_t index, size_t hash) {
+        if (!Layout::filter) return;
+        uint64_t mixed = filterMix(hash);
+        filterWord(index, mixed) |= filterMask(mixed);
+        if (Layout::deamortized && index < copied_) {
+            grownFilter_[index * filterWords + (mixed >> 32) % filterWords] |= filterMask(mixed);
+        }
+    }
+
+    // Small sets: while a set holds at most N keys its directory is the single
+    // slot smallSlot_, pointing to a bucket constructed in small_, with bitmap
+    // and filter words next to it; nothing is allocated. The first key beyond
+    // N moves everything to a heap directory. Pointer layouts only, the bucket
+    // must not be over-aligned.
+    static const bool inlineBucket = !Layout::compact && alignof(Bucket) <= alignof(std::max_align_t)
+                                     && sizeof(Bucket) <= Layout::inlineBytes;
+    using Inline = std::integral_constant<bool, inlineBucket>;
+
+    typename std::aligned_storage<inlineBucket ? sizeof(Bucket) : 1, inlineBucket ? alignof(Bucket) : 1>::type small_;
+    Link smallSlot_{};
+    uint64_t smallBits_{0};
+    uint64_t smallFilter_[filterWords]{};
+
+    Bucket* smallBucket() const { return reinterpret_cast<Bucket*>(const_cast<void*>(static_cast<const void*>(&small_))); }
+
+    bool isSmall() const { return table_ == &smallSlot_; }
+
+    // Initial directory: the inline slot, or 4 heap slots. The inline bucket
+    // starts as a copy of *keys if given.
+    void initDirectory(const Bucket* keys = nullptr) { initDirectory(keys, Inline{}); }
+
+    void initDirectory(const Bucket* keys, std::true_type) {
+        if (keys)
+            ::new (&small_) Bucket(*keys);
+        else
+            ::new (&small_) Bucket();
+        smallSlot_ = smallBucket();
+        table_ = &smallSlot_;
+        occupied_ = &smallBits_;
+        if (Layout::filter) filter_ = smallFilter_;
+        tableSize_ = 1;
+        d_ = 0;
+        nextToSplit_ = 0;
+    }
+
+    void initDirectory(const Bucket*, std::false_type) { allocateDirectory(); }
+
+    void allocateDirectory() {
+        Link* table = new Link[4]();
+        uint64_t* bits = nullptr;
+        uint64_t* filter = nullptr;
+        Grown grown;
+        try {
+            bits = new uint64_t[bitmapWords(4)]();
+            if (Layout::filter) filter = new uint64_t[4 * filterWords]();
+            if (Layout::deamortized) grown.allocate(8);
+            for (size_t i = 0; i < 4; ++i) {
+                table[i] = newBucket();
+            }
+        } catch (...) {
+            for (size_t i = 0; i < 4; ++i) {
+                releaseChain(table[i]);
+            }
+            delete[] table;
+            delete[] bits;
+            delete[] filter;
+            grown.release();
+            throw;
+        }
+        table_ = table;
+        occupied_ = bits;
+        filter_ = filter;
+        tableSize_ = 4;
+        d_ = 2;
+        nextToSplit_ = 0;
+        adoptGrown(grown);
+        while (Layout::deamortized && copied_ < tableSize_) copySlot();
+    }
+
+    // Arrays of a directory with `capacity` slots, left uninitialized
+    struct Grown {
+        Link* table{nullptr};
+        uint64_t* bits{nullptr};
+        uint64_t* filter{nullptr};
+
+        void allocate(size_t capacity) {
+            try {
+                table = new Link[capacity];
+                bits = new uint64_t[bitmapWords(capacity)];
+                if (Layout::filter) filter = new uint64_t[capacity * filterWords];
+            } catch (...) {
+                release();
+                throw;
+            }
+        }
+
+        void release() {
+            delete[] table;
+            delete[] bits;
+            delete[] filter;
+        }
+    };
+
+    // Replaces the next round's directory, nothing copied yet
+    void adoptGrown(Grown& grown) {
+        delete[] grownTable_;
+        delete[] grownBits_;
+        delete[] grownFilter_;
+        grownTable_ = grown.table;
+        grownBits_ = grown.bits;
+        grownFilter_ = grown.filter;
+        copied_ = 0;
+    }
+
+    // Copies slot copied_ into the next round's directory
+    void copySlot() {
+        size_t i = copied_++;
+        grownTable_[i] = table_[i];
+        if (0 == i % 64) grownBits_[i / 64] = 0;
+        grownBits_[i / 64] |= occupied_[i / 64] & (uint64_t(1) << (i % 64));
+        if (Layout::filter) std::copy(filter_ + i * filterWords, filter_ + (i + 1) * filterWords, grownFilter_ + i * filterWords);
+    }
+
+    // Moves the keys of a small set into a heap directory
+    void spill() {
+        Bucket* bucket = smallBucket();
+        allocateDirectory();
+        smallSlot_ = Link{};
+        smallBits_ = 0;
+        std::fill(smallFilter_, smallFilter_ + filterWords, 0);
+        size_ = 0;
+        while (bucket->nextFreeIndex) {
+            Key& key = bucket->keys[bucket->nextFreeIndex - 1];
+            insertUnchecked(std::move(key));
+            key.~Key();
+            --bucket->nextFreeIndex;
+        }
+    }
+
+    // The inline buckets stay in place, their keys change sides
+    void swapInline(ADS_set&, std::false_type) {}
+
+    void swapInline(ADS_set& other, std::true_type) {
+        Bucket* mine = smallBucket();
+        Bucket* theirs = other.smallBucket();
+        Bucket tmp;
+        relocate(tmp.keys, mine->keys, mine->nextFreeIndex);
+        std::swap(tmp.nextFreeIndex, mine->nextFreeIndex);
+        relocate(mine->keys, theirs->keys, theirs->nextFreeIndex);
+        std::swap(mine->nextFreeIndex, theirs->nextFreeIndex);
+        relocate(theirs->keys, tmp.keys, tmp.nextFreeIndex);
+        std::swap(theirs->nextFreeIndex, tmp.nextFreeIndex);
+
+        std::swap(smallSlot_, other.smallSlot_);
+        if (smallSlot_) smallSlot_ = mine;
+        if (other.smallSlot_) other.smallSlot_ = theirs;
+        std::swap(smallBits_, other.smallBits_);
+        std::swap_ranges(smallFilter_, smallFilter_ + filterWords, other.smallFilter_);
+        useOwnInline(other);
+        other.useOwnInline(*this);
+    }
+
+    // After swap(): directory pointers into other's inline storage move to ours
+    void useOwnInline(const ADS_set& other) {
+        if (table_ != &other.smallSlot_) return;
+        table_ = &smallSlot_;
+        occupied_ = &smallBits_;
+        if (Layout::filter) filter_ = smallFilter_;
+    }
+
+    void constructInline(std::false_type) {}
+    void constructInline(std::true_type) { ::new (&small_) Bucket(); }
+
+    void destroyInline(std::false_type) {}
+    void destroyInline(std::true_type) { smallBucket()->~Bucket(); }
+
+    // Recomputes the filter of slot index from its keys
+    void rebuildFilter(size_t index) {
+        if (!Layout::filter) return;
+        std::fill(filter_ + index * filterWords, filter_ + (index + 1) * filterWords, uint64_t(0));
+        if (Layout::deamortized && index < copied_) {
+            std::fill(grownFilter_ + index * filterWords, grownFilter_ + (index + 1) * filterWords, uint64_t(0));
+        }
+        for (const Bucket* bucket = head(index); bucket; bucket = next(bucket)) {
+            for (size_t i = 0; i < bucket->nextFreeIndex; ++i) {
+                addToFilter(index, hasher{}(bucket->keys[i]));
+            }
+        }
+    }
 
     void split() {
+        if (Layout::deamortized) {
+            splitDeamortized();
+            return;
+        }
         if (0 == nextToSplit_) {
-            Bucket** tmp = new Bucket*[tableSize_ * 2];
+            Link* tmp = new Link[tableSize_ * 2];
+            uint64_t* bits = nullptr;
+            uint64_t* filter = nullptr;
+            try {
+                bits = new uint64_t[bitmapWords(tableSize_ * 2)]();
+                if (Layout::filter) filter = new uint64_t[tableSize_ * 2 * filterWords]();
+            } catch (...) {
+                delete[] tmp;
+                delete[] bits;
+                throw;
+            }
             for (size_t i = 0; i < tableSize_; ++i) {
                 tmp[i] = table_[i];
             }
+            std::copy(occupied_, occupied_ + bitmapWords(tableSize_), bits);
+            if (Layout::filter) std::copy(filter_, filter_ + tableSize_ * filterWords, filter);
             delete[] table_;
+            delete[] occupied_;
+            delete[] filter_;
             table_ = tmp;
+            occupied_ = bits;
+            filter_ = filter;
+        }
+        table_[tableSize_++] = newBucket();
+    }
+
+    // The directory of a new round was completed during the last one. Slots
+    // appended to it start out uninitialized, every split copies two slots.
+    void splitDeamortized() {
+        if (0 == nextToSplit_) {
+            Grown grown;
+            grown.allocate(tableSize_ * 4);
+            delete[] table_;
+            delete[] occupied_;
+            delete[] filter_;
+            table_ = grownTable_;
+            occupied_ = grownBits_;
+            filter_ = grownFilter_;
+            grownTable_ = nullptr;
+            grownBits_ = nullptr;
+            grownFilter_ = nullptr;
+            adoptGrown(grown);
+        }
+        size_t index = tableSize_;
+        table_[index] = newBucket();
+        if (0 == index % 64) occupied_[index / 64] = 0;
+        if (Layout::filter) std::fill(filter_ + index * filterWords, filter_ + (index + 1) * filterWords, uint64_t(0));
+        ++tableSize_;
+        for (size_t i = 0; i < 2 && copied_ < tableSize_; ++i) {
+            copySlot();
         }
-        table_[tableSize_++] = new Bucket();
     }
 
     void reserve(size_t n) {
+        if (isSmall()) {
+            if (n <= N) return;
+            spill();
+        }
         // instead of capacity we tweak buckets in main directory
-        if (n / float(N * tableSize_) > maxLoadFactor_) {
-            split();
-            rehash(nextToSplit_++);
-            // Splitting is through
-            if (1 << d_ == nextToSplit_) {
-                ++d_;
-                nextToSplit_ = 0;
-            }
+        if (Layout::split::on_load && n / float(N * tableSize_) > maxLoadFactor_ * (Layout::deferred ? 2 : 1)) {
+            splitNext();
+        }
+    }
+
+    void splitNext() {
+        split();
+        size_t index = nextToSplit_++;
+        if (Layout::partial)
+            expand(index);
+        else if (Layout::spiral)
+            rehash(spiralSlot(tableSize_ - 1), tableSize_ - 1);
+        else
+            rehash(index, tableSize_ - 1);
+        // Splitting is through
+        if (1 << d_ == nextToSplit_) {
+            ++d_;
+            nextToSplit_ = 0;
         }
     }
 
 
-    size_t bucketAddress(const Key& key) const {
-        size_t n = hasher{}(key);
+    size_t bucketAddress(const Key& key) const { return addressOf(hasher{}(key)); }
+
+    size_t addressOf(size_t n) const {
+        if (Layout::partial) return d_ ? partialAddress(n) : 0;
+        if (Layout::spiral) return spiralAddress(n);
         if (n % (size_t)(1 << d_) >= nextToSplit_)
             return n % (size_t)(1 << d_);
         else
             return n % (size_t)(1 << (d_ + 1));
     }
 
-    void rehash(size_t index) {
-        Bucket* bucket = table_[index];
+    // Partial expansions, 2^d slots growing to 2^(d+1) in G = 2^(d-1) groups:
+    // group g has the slots g + m * G of its members m. The first step gives
+    // every group a third member, the second a fourth one; nextToSplit_ < G
+    // counts the groups done in the first step, nextToSplit_ - G those of the
+    // second. Per level a key draws the bits b1, b0 and a third t (1 in 3):
+    // it starts in member s, the bit b1 of the level before, and ends in
+    // r = b1 ? 2 + b0 : s. With three members it sits in member 2 if r is 2
+    // or r is 3 and t, else in s. Keys only ever move to the new member and
+    // every member gets the same share of its group's keys. The final slot
+    // g + r * G is the start of the next level, so bit j of a slot is
+    // A_j ? B_j : A_(j-1) for the bits A of the hash and B of another mix;
+    // A_(-1) is B_63, as the high bits of 32 bit hashes are all zero.
+    static uint64_t addressMix(size_t hash) {
+        uint64_t y = hash;
+        y ^= y >> 33;
+        y *= 0xff51afd7ed558ccdull;
+        y ^= y >> 33;
+        y *= 0xc4ceb9fe1a85ec53ull;
+        return y ^ y >> 33;
+    }
 
-        size_t address = index + (1 << d_);
-        Bucket* splittedBucketToStore = table_[address];
+    size_t partialAddress(size_t n) const {
+        size_t groups = size_t(1) << (d_ - 1);
+        uint64_t x = n;
+        uint64_t y = addressMix(n);
+        uint64_t slotBits = (x & y) | (~x & (x << 1 | y >> 63));
+        size_t group = slotBits & (groups - 1);
+
+        size_t inTwo = (x >> (d_ - 2)) & 1;
+        size_t inFour = (x >> (d_ - 1)) & 1 ? 2 + ((y >> (d_ - 1)) & 1) : inTwo;
+        size_t inThree = 2 == inFour || (3 == inFour && (y >> d_) % 3 == 0) ? 2 : inTwo;
+        size_t member;
+        if (nextToSplit_ < groups)
+            member = group < nextToSplit_ ? inThree : inTwo;
+        else
+            member = group < nextToSplit_ - groups ? inFour : inThree;
+        return group + member * groups;
+    }
 
-        while (bucket) {
-            for (size_t i = 0; i < bucket->nextFreeIndex; ++i) {
-                if (bucketAddress(bucket->keys[i]) != index) {
-                    if (splittedBucketToStore->nextFreeIndex == N) {
-                        splittedBucketToStore->overflowBucket = new Bucket();
-                        splittedBucketToStore = splittedBucketToStore->overflowBucket;
-                    }
+    // Spiral storage with growth factor 2: the logical buckets [F, 2F) are
+    // in use, F = 2^d + nextToSplit_ = tableSize_. A key has the bucket
+    // floor(2^x) for the x in [log2 F, log2 F + 1) whose fraction is h, its
+    // mixed hash as a fraction of 1, so bucket y gets a share log2(1 + 1/y).
+    // An expansion gives the keys of bucket F to 2F and 2F + 1. Bucket 2F
+    // keeps the slot of F, 2F + 1 gets the new slot F, so bucket y, the odd
+    // number o times a power of two, is in slot (o - 1) / 2.
+    static size_t spiralSlot(size_t bucket) { return (bucket >> __builtin_ctzll(bucket)) >> 1; }
+
+    size_t spiralAddress(size_t n) const {
+        // 52 bits, so that the power stays below 2
+        double power = std::exp2(double(addressMix(n) >> 12) / 4503599627370496.0);
+        size_t bucket = size_t(std::ldexp(power, int(d_)));
+        if (bucket < tableSize_) bucket = size_t(std::ldexp(power, int(d_ + 1)));
+        return spiralSlot(bucket);
+    }
 
-                    splittedBucketToStore->keys[splittedBucketToStore->nextFreeIndex] = bucket->keys[i];
-                    ++splittedBucketToStore->nextFreeIndex;
+    // Gives group index % G the slot split() appended. In the first step the
+    // keys come from members 0 and 1, in the second from all three.
+    void expand(size_t index) {
+        size_t groups = size_t(1) << (d_ - 1);
+        size_t members = index < groups ? 2 : 3;
+        for (size_t m = 0; m < members; ++m) {
+            rehash(index % groups + m * groups, tableSize_ - 1);
+        }
+    }
+
+    // Moves the keys of slot index that now address slot address there.
+    // Runs of keys with the same destination are moved as one block; the
+    // keys that stay are packed into the front of the chain and the buckets
+    // this empties become spare.
+    void rehash(size_t index, size_t address) {
+        Bucket* bucket = head(index);
+        Bucket* keep = bucket;
+        size_t kept = 0;
+
+        Bucket* splittedBucketToStore = head(address);
+        while (splittedBucketToStore->nextFreeIndex == N && splittedBucketToStore->overflowBucket) {
+            splittedBucketToStore = next(splittedBucketToStore);
+        }
 
-                    // restores
-                    for(size_t j = i + 1; j < bucket->nextFreeIndex; ++j) {
-                        bucket->keys[j - 1] = bucket->keys[j];
+        while (bucket) {
+            size_t n = bucket->nextFreeIndex;
+            bool stays = n && bucketAddress(bucket->keys[0]) == index;
+            for (size_t i = 0; i < n;) {
+                size_t j = i + 1;
+                bool nextStays = stays;
+                while (j < n && (nextStays = bucketAddress(bucket->keys[j]) == index) == stays) ++j;
+
+                if (stays) {
+                    for (size_t first = i; first < j;) {
+                        if (kept == N) {
+                            keep->nextFreeIndex = N;
+                            keep = next(keep);
+                            kept = 0;
+                        }
+                        size_t m = std::min<size_t>(j - first, N - kept);
+                        if (keep->keys + kept != bucket->keys + first) relocate(keep->keys + kept, bucket->keys + first, m);
+                        kept += m;
+                        first += m;
+                    }
+                } else {
+                    for (size_t first = i; first < j;) {
+                        if (splittedBucketToStore->nextFreeIndex == N) {
+                            splittedBucketToStore = appendBucket(splittedBucketToStore);
+                        }
+                        size_t m = std::min<size_t>(j - first, N - splittedBucketToStore->nextFreeIndex);
+                        relocate(splittedBucketToStore->keys + splittedBucketToStore->nextFreeIndex,
+                                 bucket->keys + first, m);
+                        splittedBucketToStore->nextFreeIndex += m;
+                        first += m;
                     }
-                    --bucket->nextFreeIndex;
-                    // Recalculate again since moved back
-                    --i;
                 }
+                i = j;
+                stays = nextStays;
             }
+            if (bucket != keep) bucket->nextFreeIndex = 0;
 
-            bucket = bucket->overflowBucket;
+            bucket = next(bucket);
+        }
+        keep->nextFreeIndex = kept;
+        releaseAfter(keep);
+
+        // Both halves are stable partitions, but a bucket may have been
+        // filled from several source buckets
+        if (Layout::sorted) {
+            for (Bucket* source = head(index); source; source = next(source)) source->sort();
+            for (Bucket* target = head(address); target; target = next(target)) target->sort();
         }
+
+        markOccupied(address, head(address)->nextFreeIndex != 0);
+        markOccupied(index, chainSize(head(index)) != 0);
+        // drops the bits of moved and of erased keys
+        rebuildFilter(index);
+        rebuildFilter(address);
     }
 
-    iterator insertUnchecked(const key_type &key) {
-        size_type address = bucketAddress(key);
-        Bucket* bucket = table_[address];
+    iterator insertUnchecked(const key_type &key) { return placeUnchecked<const key_type&>(key); }
+    iterator insertUnchecked(key_type&& key) { return placeUnchecked<key_type>(std::move(key)); }
+
+    template<typename K>
+    iterator placeUnchecked(K&& key) {
+        size_t hash = hasher{}(key);
+        size_type address = addressOf(hash);
+        if (Layout::split::chain_limit && !isSmall() && fullChain(address) >= Layout::split::chain_limit) {
+            splitNext();
+            address = addressOf(hash);
+        }
+        Bucket* bucket = head(address);
 
         while(bucket->nextFreeIndex > N - 1) {
-            if (nullptr == bucket->overflowBucket) {
-                bucket->overflowBucket = new Bucket();
+            if (!bucket->overflowBucket) {
+                appendBucket(bucket);
             }
-            bucket = bucket->overflowBucket;
+            bucket = next(bucket);
         }
 
-        size_t savedAtIndex = bucket->nextFreeIndex;
-        bucket->keys[savedAtIndex] = key;
+        size_t savedAtIndex = bucket->add(std::forward<K>(key));
+        markOccupied(address, true);
+        addToFilter(address, hash);
         ++size_;
-        ++bucket->nextFreeIndex;
-        return iterator{bucketBegin(address), bucketEnd(), bucket, savedAtIndex};
+        return iterator{this, address, bucket, savedAtIndex};
 
     }
 
-    bucketIterator bucketBegin(size_t index) const { return bucketIterator(this->table_, index, tableSize_); }
-    bucketIterator bucketEnd() const { return bucketIterator(this->table_, SIZE_INVALID, tableSize_); }
+    // Number of buckets in the chain of slot index if all are full, else 0
+    size_t fullChain(size_t index) const {
+        size_t buckets = 0;
+        for (const Bucket* bucket = head(index); bucket; bucket = next(bucket)) {
+            if (bucket->nextFreeIndex < N) return 0;
+            ++buckets;
+        }
+        return buckets;
+    }
+
+    // Directory slots allocated for the current round: split() doubles the
+    // array when a round starts, so mid-round it already holds 2^(d+1) entries.
+    size_t directoryCapacity() const {
+        return 0 == nextToSplit_ ? tableSize_ : (size_t(1) << (d_ + 1));
+    }
+
+    static Bucket* cloneChain(const Bucket* source) {
+        Bucket* head = nullptr;
+        Bucket** link = &head;
+        try {
+            for (; source; source = source->overflowBucket) {
+                *link = new Bucket(*source);
+                (*link)->overflowBucket = nullptr;
+                link = &(*link)->overflowBucket;
+            }
+        } catch (...) {
+            while (head) {
+                Bucket* next = head->overflowBucket;
+                delete head;
+                head = next;
+            }
+            throw;
+        }
+        return head;
+    }
+
+    // Copies the buckets of other; table_ is allocated and zeroed
+    void cloneBuckets(const ADS_set& other, size_t threads, std::false_type) {
+        parallelFor(tableSize_, threads, [this, &other](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                table_[i] = cloneChain(other.table_[i]);
+            }
+        });
+    }
+
+    // Pool indices stay valid in a copy of the pool
+    void cloneBuckets(const ADS_set& other, size_t threads, std::true_type) {
+        pool_.assign(other.pool_, threads);
+        std::copy(other.table_, other.table_ + tableSize_, table_);
+        spare_ = other.spare_;
+    }
+
+    // Runs f(first, last) over [0, n) split into up to `threads` contiguous
+    // ranges; the first exception thrown by any worker is rethrown after join.
+    template<typename F>
+    static void parallelFor(size_t n, size_t threads, F f) {
+        if (threads > n) threads = n;
+        if (threads <= 1) {
+            f(size_t{0}, n);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        std::vector<std::exception_ptr> errors(threads);
+        size_t chunk = (n + threads - 1) / threads;
+        for (size_t t = 0; t < threads; ++t) {
+            size_t first = t * chunk;
+            size_t last = std::min(n, first + chunk);
+            workers.emplace_back([&f, &errors, t, first, last]() {
+                try {
+                    f(first, last);
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        for (auto& worker: workers) worker.join();
+        for (auto& error: errors) {
+            if (error) std::rethrow_exception(error);
+        }
+    }
+
+    // Iterator to the first key in the chain of slot index, end() if index is tableSize_
+    iterator firstIn(size_t index) const {
+        if (index == tableSize_) return end();
+
+        Bucket* bucket = head(index);
+        while (0 == bucket->nextFreeIndex) {
+            bucket = next(bucket);
+        }
+        return iterator{this, index, bucket, 0};
+    }
+
+    size_t chainSize(const Bucket* bucket) const {
+        size_t n = 0;
+        for (; bucket; bucket = next(bucket)) {
+            n += bucket->nextFreeIndex;
+        }
+        return n;
+    }
+
+    bool chainContains(const Bucket* bucket, const Key& key) const {
+        for (; bucket; bucket = next(bucket)) {
+            if (SIZE_INVALID != bucket->indexOf(key)) return true;
+        }
+        return false;
+    }
+
+    // lhs is a chain of this set, rhs one of other
+    bool chainsEqual(const Bucket* lhs, const ADS_set& other, const Bucket* rhs) const {
+        if (chainSize(lhs) != other.chainSize(rhs)) return false;
+        for (const Bucket* bucket = rhs; bucket; bucket = other.next(bucket)) {
+            for (size_t i = 0; i < bucket->nextFreeIndex; ++i) {
+                if (!chainContains(lhs, bucket->keys[i])) return false;
+            }
+        }
+        return true;
+    }
+
+    // Splits the slots of an empty set until it has tableSize of them
+    void growDirectory(size_t tableSize) {
+        if (isSmall() && tableSize > 1) spill();
+        while (tableSize_ < tableSize) {
+            split();
+            if (size_t(1) << d_ == ++nextToSplit_) {
+                ++d_;
+                nextToSplit_ = 0;
+            }
+        }
+    }
+
+    // Adds the keys of chain `from` that satisfy keep and address slot
+    // index to it; *tail is the last bucket of its chain. Returns how many
+    // were added. Touches nothing shared with other slots except the pool.
+    template<typename Keep>
+    size_t appendTo(size_t index, Bucket*& tail, const ADS_set& owner, const Bucket* from, Keep keep) {
+        size_t n = 0;
+        for (; from; from = owner.next(from)) {
+            for (size_t i = 0; i < from->nextFreeIndex; ++i) {
+                size_t hash = hasher{}(from->keys[i]);
+                if (addressOf(hash) != index || !keep(from->keys[i])) continue;
+                if (tail->nextFreeIndex == N) tail = appendBucket(tail);
+                tail->add(from->keys[i]);
+                addToFilter(index, hash);
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    // Set operation of lhs and rhs with the same directory shape, so a key
+    // sits in the same slot on both sides. The result is sized for `size`
+    // keys, at least like lhs; each of its slots j draws from one slot
+    // lhs.addressOf(j) of lhs and rhs. fill(result, j, source, tail) builds
+    // slot j and returns its key count. Slots are split across `threads`,
+    // except with the (single threaded) bucket pool of compact layouts.
+    template<typename F>
+    static ADS_set combineSlots(const ADS_set& lhs, size_t size, size_t threads, F fill) {
+        ADS_set result;
+        result.maxLoadFactor_ = lhs.maxLoadFactor_;
+        size_t tableSize = lhs.tableSize_;
+        // a slot of partial expansions or spiral storage may draw from other
+        // slots of a smaller directory than addressOf(j), so those results
+        // take the directory of lhs and split later
+        while (linearSlots && size / float(N * tableSize) > lhs.maxLoadFactor_) ++tableSize;
+        // more than N keys need a heap directory, the inline bucket takes no
+        // overflow buckets; all its slots draw from the one slot of a small lhs
+        result.growDirectory(size > N ? std::max<size_t>(tableSize, 2) : tableSize);
+        if (Layout::compact) threads = 1;
+
+        std::atomic<size_t> total{0};
+        parallelFor(result.tableSize_, threads, [&result, &lhs, &total, &fill](size_t first, size_t last) {
+            size_t n = 0;
+            for (size_t j = first; j < last; ++j) {
+                Bucket* tail = result.head(j);
+                n += fill(result, j, linearSlots ? lhs.addressOf(j) : lhs.isSmall() ? 0 : j, tail);
+            }
+            total += n;
+        });
+        result.size_ = total;
+        // bitmap words are shared between slots, so they are set afterwards
+        for (size_t j = 0; j < result.tableSize_; ++j) {
+            result.markOccupied(j, result.head(j)->nextFreeIndex != 0);
+        }
+        while (!linearSlots && !result.isSmall() && result.size_ / float(N * result.tableSize_) > result.maxLoadFactor_) {
+            result.splitNext();
+        }
+        return result;
+    }
+
+    // Each operation below falls back to probing when the directories differ
+    static bool sameShape(const ADS_set& lhs, const ADS_set& rhs) {
+        return lhs.d_ == rhs.d_ && lhs.nextToSplit_ == rhs.nextToSplit_;
+    }
+
+    // On-disk header of save()/load(), native byte order
+    struct SnapshotHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t keySize;
+        uint32_t bucketSize;
+        float maxLoadFactor;
+        // addressOf(), see addressing()
+        uint32_t addressing;
+        uint64_t d;
+        uint64_t nextToSplit;
+        uint64_t tableSize;
+        uint64_t size;
+    };
+    static const uint32_t SNAPSHOT_VERSION = 1;
+
+    // 0 linear hashing, 1 partial expansions, 2 spiral storage
+    static uint32_t addressing() { return Layout::partial ? 1 : Layout::spiral ? 2 : 0; }
+
+    template<typename T>
+    static void writeRaw(std::ostream& o, const T& value) {
+        o.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template<typename T>
+    static void readRaw(std::istream& i, T& value) {
+        if (!i.read(reinterpret_cast<char*>(&value), sizeof(value)))
+            throw std::runtime_error("ADS_set snapshot truncated");
+    }
 
 public:
     ADS_set() {
-        tableSize_ = (size_t)(1<<d_);
-        table_ = new Bucket*[tableSize_];
-        for (size_t i = 0; i < tableSize_; ++i) {
-            table_[i] = new Bucket();
-        }
+        initDirectory();
     }
 
     ADS_set(std::initializer_list<key_type> ilist): ADS_set{} {
@@ -217,18 +1303,64 @@ public:
     };
     template<typename InputIt> ADS_set(InputIt first, InputIt last): ADS_set{} { insert(first, last); }
 
-    ADS_set(const ADS_set& other): ADS_set{} {
-        for (const_iterator it = other.begin(); it != other.end(); ++it){
-            insert(*it);
+    ADS_set(const ADS_set& other): ADS_set{other, 1} {}
+
+    // Clones directory and bucket layout as is, so nothing gets rehashed.
+    // Chains are copied by `threads` workers, worth it for very large sets.
+    ADS_set(const ADS_set& other, size_t threads)
+            : tableSize_{other.tableSize_}
+            , d_{other.d_}
+            , nextToSplit_{other.nextToSplit_}
+            , maxLoadFactor_{other.maxLoadFactor_}
+    {
+        if (other.isSmall()) {
+            initDirectory(other.smallBucket());
+            smallBits_ = other.smallBits_;
+            std::copy(other.smallFilter_, other.smallFilter_ + filterWords, smallFilter_);
+            size_ = other.size_;
+            return;
+        }
+        constructInline(Inline{});
+        table_ = new Link[other.directoryCapacity()]();
+        Grown grown;
+        try {
+            occupied_ = new uint64_t[bitmapWords(other.directoryCapacity())]();
+            std::copy(other.occupied_, other.occupied_ + bitmapWords(tableSize_), occupied_);
+            if (Layout::filter) {
+                filter_ = new uint64_t[other.directoryCapacity() * filterWords]();
+                std::copy(other.filter_, other.filter_ + tableSize_ * filterWords, filter_);
+            }
+            if (Layout::deamortized) grown.allocate(other.directoryCapacity() * 2);
+            cloneBuckets(other, threads, Compact{});
+        } catch (...) {
+            for (size_t i = 0; i < tableSize_; ++i) {
+                releaseChain(table_[i]);
+            }
+            delete[] table_;
+            delete[] occupied_;
+            delete[] filter_;
+            grown.release();
+            throw;
         }
+        size_ = other.size_;
+        adoptGrown(grown);
+        while (copied_ < other.copied_) copySlot();
     }
 
     ~ADS_set() {
-        for (size_t i = 0; i < tableSize_; ++i) {
-            delete table_[i];
+        if (!isSmall()) {
+            for (size_t i = 0; i < tableSize_; ++i) {
+                releaseChain(table_[i]);
+            }
+            delete[] table_;
+            delete[] occupied_;
+            delete[] filter_;
         }
-
-        delete[] table_;
+        delete[] grownTable_;
+        delete[] grownBits_;
+        delete[] grownFilter_;
+        releaseChain(spare_);
+        destroyInline(Inline{});
     }
 
     ADS_set &operator=(const ADS_set &other) {
@@ -247,6 +1379,31 @@ public:
 
     bool empty() const { return !size_;};
 
+    size_type bucket_count() const { return tableSize_; }
+
+    // Buckets in the chain of slot n, 1 + its overflow buckets
+    size_type chain_length(size_type n) const {
+        size_type buckets = 0;
+        for (const Bucket* bucket = head(n); bucket; bucket = next(bucket)) {
+            ++buckets;
+        }
+        return buckets;
+    }
+
+    // Buckets a successful lookup reads on average, k for a key in the k-th
+    // bucket of its chain
+    double average_probe_length() const {
+        if (empty()) return 0;
+        size_t probes = 0;
+        for (size_t i = 0; i < tableSize_; ++i) {
+            size_t k = 1;
+            for (const Bucket* bucket = head(i); bucket; bucket = next(bucket), ++k) {
+                probes += k * bucket->nextFreeIndex;
+            }
+        }
+        return double(probes) / double(size_);
+    }
+
     // Wie oft gegebene Wert gespeichert ist
     size_type count(const key_type& key) const {
         if (empty()) {
@@ -254,51 +1411,80 @@ public:
         }
 
 
-        size_type index = bucketAddress(key);
+        size_t hash = hasher{}(key);
+        size_type index = addressOf(hash);
+        if (!mayContain(index, hash)) {
+            return 0;
+        }
 
-        Bucket* bucket = table_[index];
+        Bucket* bucket = head(index);
 
         while (bucket) {
-            for (size_type i{0}; i < bucket->nextFreeIndex; ++i) {
-                if (key_equal{}(key, bucket->keys[i])) {
-                    return 1;
-                }
+            if (SIZE_INVALID != bucket->indexOf(key)) {
+                return 1;
             }
 
-            bucket = bucket->overflowBucket;
+            bucket = next(bucket);
         }
 
         return 0;
     };
 
     iterator find(const key_type& key) const {
-        size_t index = bucketAddress(key);
-        Bucket* bucket = table_[index];
+        size_t hash = hasher{}(key);
+        size_t index = addressOf(hash);
+        if (!mayContain(index, hash)) return end();
+        Bucket* bucket = head(index);
         while (bucket) {
-            for (size_t i = 0; i < bucket->nextFreeIndex; ++i) {
-                if (key_equal{}(key, bucket->keys[i])) {
-                    return iterator{bucketBegin(index), bucketEnd(), bucket, i};
-                }
+            size_t i = bucket->indexOf(key);
+            if (SIZE_INVALID != i) {
+                return iterator{this, index, bucket, i};
             }
 
-            bucket = bucket->overflowBucket;
+            bucket = next(bucket);
         }
 
         return end();
     };
 
+    // Removes all keys but keeps directory and buckets for the keys to come
     void clear() {
+        for (size_t i = 0; i < tableSize_; ++i) {
+            clearChain(i);
+        }
+        std::fill(occupied_, occupied_ + bitmapWords(directoryCapacity()), 0);
+        if (Layout::filter) std::fill(filter_, filter_ + directoryCapacity() * filterWords, 0);
+        if (Layout::deamortized) {
+            std::fill(grownBits_, grownBits_ + bitmapWords(copied_), 0);
+            if (Layout::filter) std::fill(grownFilter_, grownFilter_ + copied_ * filterWords, 0);
+        }
+        size_ = 0;
+    }
+
+    // Removes all keys and releases the memory, back to the initial directory
+    void clear_and_shrink() {
         ADS_set tmp;
+        tmp.maxLoadFactor_ = maxLoadFactor_;
         swap(tmp);
     }
 
+    // Keeps iterators valid except into inline buckets, see above
     void swap(ADS_set &other) {
         std::swap(table_, other.table_);
+        std::swap(spare_, other.spare_);
+        pool_.swap(other.pool_);
+        std::swap(occupied_, other.occupied_);
+        std::swap(filter_, other.filter_);
+        std::swap(grownTable_, other.grownTable_);
+        std::swap(grownBits_, other.grownBits_);
+        std::swap(grownFilter_, other.grownFilter_);
+        std::swap(copied_, other.copied_);
         std::swap(d_, other.d_);
         std::swap(nextToSplit_, other.nextToSplit_);
         std::swap(size_, other.size_);
         std::swap(tableSize_, other.tableSize_);
         std::swap(maxLoadFactor_, other.maxLoadFactor_);
+        swapInline(other, Inline{});
     }
 
     void insert(std::initializer_list<key_type> ilist) {
@@ -331,42 +1517,243 @@ public:
     }
 
     size_type erase(const key_type &key) {
-        size_t index = bucketAddress(key);
-        Bucket* bucket = table_[index];
+        size_t hash = hasher{}(key);
+        size_t index = addressOf(hash);
+        if (!mayContain(index, hash)) return 0;
+        Bucket* bucket = head(index);
 
         while (bucket) {
-            for (size_t i = 0; i < bucket->nextFreeIndex; ++i) {
-                if (key_equal{}(key, bucket->keys[i])) {
-                    // Move array forward
-                    --bucket->nextFreeIndex;
-                    for (size_t j = i; j < bucket->nextFreeIndex; ++j) {
-                        bucket->keys[j] = bucket->keys[j + 1];
-                    }
-                    --size_;
-                    return 1;
+            size_t i = bucket->indexOf(key);
+            if (SIZE_INVALID != i) {
+                // Move array forward
+                bucket->remove(i);
+                if (0 == bucket->nextFreeIndex && 0 == chainSize(head(index))) {
+                    markOccupied(index, false);
                 }
+                --size_;
+                return 1;
             }
 
-            bucket = bucket->overflowBucket;
+            bucket = next(bucket);
         }
 
         return 0;
     }
 
-    const_iterator begin() const {
-        iterator a{bucketBegin(0), bucketEnd(), table_[0], 0};
+    // Moves the keys of other into this set, keys already here are dropped;
+    // other is left empty. Keys are moved, never copied, and buckets other
+    // no longer needs become spare buckets here (pointer layouts), so splits
+    // and overflow buckets take those instead of allocating. If hashing,
+    // comparing or moving a key or an allocation throws, the keys not moved
+    // yet are handed back to other. The slots emptied so far get head
+    // buckets again, allocated if this has no spare ones left; should that
+    // allocation fail as well, the keys of other are destroyed.
+    void merge(ADS_set&& other) {
+        if (this == &other) return;
+        ADS_set source;
+        source.swap(other);
+
+        size_t i = 0;
+        try {
+            for (; i < source.tableSize_; ++i) {
+                Bucket* bucket = source.head(i);
+                while (bucket) {
+                    while (bucket->nextFreeIndex) {
+                        Key& key = bucket->keys[bucket->nextFreeIndex - 1];
+                        if (!count(key)) {
+                            reserve(size_ + 1);
+                            insertUnchecked(std::move(key));
+                        }
+                        key.~Key();
+                        --bucket->nextFreeIndex;
+                        --source.size_;
+                    }
+                    Bucket* following = source.next(bucket);
+                    // pool buckets and the inline one cannot change hands
+                    if (!Layout::compact && bucket != source.smallBucket()) {
+                        source.table_[i] = bucket->overflowBucket;
+                        recycle(bucket);
+                    }
+                    bucket = following;
+                }
+            }
+        } catch (...) {
+            source.restoreHeads(i, *this);
+            other.swap(source);
+            throw;
+        }
+    }
+
+    // Removes key and returns it in a node handle, an empty one if there is
+    // no such key. insert(node_type&&) puts it into a set again.
+    node_type extract(const key_type& key) {
+        iterator it{find(key)};
+        if (it == end()) return node_type{};
+        return extract(it);
+    }
+
+    node_type extract(const_iterator position) {
+        Bucket* bucket = position.position_;
+        node_type node{std::move(bucket->keys[position.index_])};
+        bucket->remove(position.index_);
+        if (0 == bucket->nextFreeIndex && 0 == chainSize(head(position.bucketIndex_))) {
+            markOccupied(position.bucketIndex_, false);
+        }
+        --size_;
+        return node;
+    }
+
+    // Moves the key of node in; if it is already here, node is handed back
+    insert_return_type insert(node_type&& node) {
+        if (node.empty()) return insert_return_type{end(), false, node_type{}};
+        iterator it{find(node.key_)};
+        if (it != end()) return insert_return_type{it, false, std::move(node)};
+
+        reserve(size_ + 1);
+        iterator position = insertUnchecked(std::move(node.key_));
+        node.reset();
+        return insert_return_type{position, true, node_type{}};
+    }
+
+    // True if the set is above its maximum load factor, which only happens
+    // with deferred layouts
+    bool needs_maintenance() const {
+        return Layout::split::on_load && !isSmall() && size_ / float(N * tableSize_) > maxLoadFactor_;
+    }
+
+    // Does the splits insert() left over until the load factor is back under
+    // its maximum or budget has passed, at least one if any is due; returns
+    // the number of splits
+    size_t maintain(std::chrono::microseconds budget) {
+        auto deadline = std::chrono::steady_clock::now() + budget;
+        size_t splits = 0;
+        while (needs_maintenance()) {
+            splitNext();
+            ++splits;
+            if (std::chrono::steady_clock::now() >= deadline) break;
+        }
+        return splits;
+    }
+
+    // Rebuilds the lookup filters of filter layouts, dropping the bits of
+    // erased keys; does nothing for other layouts.
+    void compact() {
+        for (size_t i = 0; i < tableSize_; ++i) {
+            rebuildFilter(i);
+        }
+    }
+
+    // Binary snapshot: header, then per slot the number of keys in its chain
+    // followed by the keys. load() puts every key back into its slot.
+    template<typename Serializer = ADS_serializer<Key>>
+    void save(std::ostream& o) const {
+        SnapshotHeader header{{'A', 'D', 'S', 'L'}, SNAPSHOT_VERSION, uint32_t(sizeof(Key)), uint32_t(N),
+                              maxLoadFactor_, addressing(), d_, nextToSplit_, tableSize_, size_};
+        writeRaw(o, header);
+        for (size_t i = 0; i < tableSize_; ++i) {
+            writeRaw(o, uint64_t(chainSize(head(i))));
+            for (const Bucket* bucket = head(i); bucket; bucket = next(bucket)) {
+                Serializer::write(o, bucket->keys, bucket->nextFreeIndex);
+            }
+        }
+        if (!o) throw std::runtime_error("ADS_set snapshot could not be written");
+    }
+
+    template<typename Serializer = ADS_serializer<Key>>
+    void load(std::istream& i) {
+        SnapshotHeader header;
+        readRaw(i, header);
+        if (std::string(header.magic, 4) != "ADSL" || header.version != SNAPSHOT_VERSION)
+            throw std::runtime_error("not an ADS_set snapshot");
+        if (header.keySize != sizeof(Key) || header.bucketSize != N)
+            throw std::runtime_error("ADS_set snapshot was written for a different key type or bucket size");
+        if (header.addressing != addressing())
+            throw std::runtime_error("ADS_set snapshot was written with a different addressing");
+        bool small = 0 == header.d && 0 == header.nextToSplit && 1 == header.tableSize;
+        if (!small && (header.d < 2 || header.d > 62 || header.nextToSplit >= (uint64_t(1) << header.d)
+                       || header.tableSize != (uint64_t(1) << header.d) + header.nextToSplit))
+            throw std::runtime_error("ADS_set snapshot has an invalid directory");
+        if (!std::isfinite(header.maxLoadFactor) || header.maxLoadFactor <= 0)
+            throw std::runtime_error("ADS_set snapshot has an invalid load factor");
+
+        ADS_set tmp;
+        tmp.maxLoadFactor_ = header.maxLoadFactor;
+
+        // the inline slot of a small set, for a layout without inline storage
+        bool reinsert = small && !tmp.isSmall();
+        if (reinsert) {
+            uint64_t n = 0;
+            readRaw(i, n);
+            if (n > N) throw std::runtime_error("ADS_set snapshot size mismatch");
+            Bucket keys;
+            Serializer::read(i, keys.keys, size_t(n));
+            keys.nextFreeIndex = Count(n);
+            if (!i) throw std::runtime_error("ADS_set snapshot truncated");
+            for (size_t j = 0; j < n; ++j) {
+                tmp.insertUnchecked(std::move(keys.keys[j]));
+            }
+        }
+        // Slots are appended as their chains are read, so a header alone
+        // cannot make the directory allocate more than the stream holds
+        for (size_t index = 0; index < header.tableSize && !reinsert; ++index) {
+            if (!small) tmp.growDirectory(std::max<size_t>(index + 1, 2));
+            uint64_t n = 0;
+            readRaw(i, n);
+            Bucket* bucket = tmp.head(index);
+            while (n) {
+                if (bucket->nextFreeIndex == N) {
+                    if (tmp.isSmall()) throw std::runtime_error("ADS_set snapshot size mismatch");
+                    bucket = tmp.appendBucket(bucket);
+                }
+                size_t k = std::min<uint64_t>(n, N);
+                Serializer::read(i, bucket->keys, k);
+                bucket->nextFreeIndex = k;
+                if (!i) throw std::runtime_error("ADS_set snapshot truncated");
+                bucket->sort();
+                for (size_t j = 0; Layout::filter && j < k; ++j) {
+                    tmp.addToFilter(index, hasher{}(bucket->keys[j]));
+                }
+                tmp.size_ += k;
+                tmp.markOccupied(index, true);
+                n -= k;
+            }
+        }
+        if (tmp.size_ != header.size) throw std::runtime_error("ADS_set snapshot size mismatch");
+        swap(tmp);
+    }
 
-        if (table_[0]->nextFreeIndex == 0) {
-            a.advanceToNext();
+    // Internal iteration: f(key) for every key, in iteration order
+    template<typename F>
+    void for_each(F&& f) const {
+        for (size_t i = nextOccupied(0); i < tableSize_; i = nextOccupied(i + 1)) {
+            for (const Bucket* bucket = head(i); bucket; bucket = next(bucket)) {
+                for (size_t j = 0; j < bucket->nextFreeIndex; ++j) {
+                    f(bucket->keys[j]);
+                }
+            }
+        }
+    }
+
+    // f(keys, n) once per non-empty bucket, keys[0..n) being contiguous
+    template<typename F>
+    void for_each_bucket(F&& f) const {
+        for (size_t i = nextOccupied(0); i < tableSize_; i = nextOccupied(i + 1)) {
+            for (const Bucket* bucket = head(i); bucket; bucket = next(bucket)) {
+                if (bucket->nextFreeIndex) {
+                    f(static_cast<const key_type*>(bucket->keys), bucket->nextFreeIndex);
+                }
+            }
         }
+    }
 
-        return a;
+    const_iterator begin() const {
+        return firstIn(nextOccupied(0));
     }
-    const_iterator end() const { return const_iterator{bucketEnd(), bucketEnd(), nullptr, SIZE_INVALID}; };
+    const_iterator end() const { return const_iterator{}; };
 
     void dump(std::ostream &o = std::cerr) const {
         for (size_t i = 0; i < tableSize_; ++i) {
-            Bucket* bucket = table_[i];
+            Bucket* bucket = head(i);
 
             while (bucket) {
                 for (size_type j{0}; j < N; ++j) {
@@ -374,86 +1761,155 @@ public:
                     o << " ";
                 }
 
-                bucket = bucket->overflowBucket;
+                bucket = next(bucket);
             }
 
             o << "\n";
         }
     };
 
-    friend bool operator==(const ADS_set& lhs, const ADS_set& rhs) {
-        if (lhs.size_ != rhs.size_) return false;
-
-        for (const_iterator it = rhs.begin(); it != rhs.end(); ++it) {
-            if (lhs.find(*it) == lhs.end()) return false;
+    // With equal d_ and nextToSplit_ every key lives in the same slot on
+    // both sides, so slots are compared pairwise without hashing. Otherwise
+    // each key of other is looked up here. Slots are split across `threads`.
+    bool equals(const ADS_set& other, size_t threads) const {
+        if (size_ != other.size_) return false;
+
+        std::atomic<bool> equal{true};
+        if (d_ == other.d_ && nextToSplit_ == other.nextToSplit_) {
+            parallelFor(tableSize_, threads, [this, &other, &equal](size_t first, size_t last) {
+                for (size_t i = first; i < last && equal.load(std::memory_order_relaxed); ++i) {
+                    if (!chainsEqual(head(i), other, other.head(i))) equal = false;
+                }
+            });
+        } else {
+            parallelFor(other.tableSize_, threads, [this, &other, &equal](size_t first, size_t last) {
+                for (size_t i = first; i < last && equal.load(std::memory_order_relaxed); ++i) {
+                    for (const Bucket* bucket = other.head(i); bucket; bucket = other.next(bucket)) {
+                        for (size_t j = 0; j < bucket->nextFreeIndex; ++j) {
+                            if (!count(bucket->keys[j])) {
+                                equal = false;
+                                return;
+                            }
+                        }
+                    }
+                }
+            });
         }
+        return equal;
+    }
 
-        return true;
+    friend bool operator==(const ADS_set& lhs, const ADS_set& rhs) {
+        return lhs.equals(rhs, 1);
     };
     friend bool operator!=(const ADS_set& lhs, const ADS_set& rhs) {
         return !(lhs == rhs);
     };
+
+    // Set algebra. When lhs and rhs have the same d and nextToSplit, slot i
+    // of the result is merged from slot i of both without hashing into the
+    // other set, by up to `threads` workers.
+    friend ADS_set set_union(const ADS_set& lhs, const ADS_set& rhs, size_t threads = 1) {
+        if (!sameShape(lhs, rhs)) {
+            ADS_set result{lhs};
+            rhs.for_each([&result](const key_type& key) { result.insert(key); });
+            return result;
+        }
+        // counted first, so the result is built with its final directory
+        std::atomic<size_t> size{lhs.size_};
+        parallelFor(lhs.tableSize_, threads, [&lhs, &rhs, &size](size_t first, size_t last) {
+            size_t n = 0;
+            for (size_t i = first; i < last; ++i) {
+                const Bucket* own = lhs.head(i);
+                for (const Bucket* bucket = rhs.head(i); bucket; bucket = rhs.next(bucket)) {
+                    for (size_t j = 0; j < bucket->nextFreeIndex; ++j) {
+                        n += !lhs.chainContains(own, bucket->keys[j]);
+                    }
+                }
+            }
+            size += n;
+        });
+        return combineSlots(lhs, size, threads, [&lhs, &rhs](ADS_set& result, size_t j, size_t i, Bucket*& tail) {
+            const Bucket* own = lhs.head(i);
+            return result.appendTo(j, tail, lhs, own, [](const key_type&) { return true; })
+                   + result.appendTo(j, tail, rhs, rhs.head(i), [&lhs, own](const key_type& key) {
+                         return !lhs.chainContains(own, key);
+                     });
+        });
+    }
+
+    friend ADS_set set_intersection(const ADS_set& lhs, const ADS_set& rhs, size_t threads = 1) {
+        if (!sameShape(lhs, rhs)) {
+            ADS_set result;
+            lhs.for_each([&result, &rhs](const key_type& key) {
+                if (rhs.count(key)) result.insert(key);
+            });
+            return result;
+        }
+        return combineSlots(lhs, 0, threads, [&lhs, &rhs](ADS_set& result, size_t j, size_t i, Bucket*& tail) {
+            const Bucket* other = rhs.head(i);
+            return result.appendTo(j, tail, lhs, lhs.head(i), [&rhs, other](const key_type& key) {
+                return rhs.chainContains(other, key);
+            });
+        });
+    }
+
+    friend ADS_set set_difference(const ADS_set& lhs, const ADS_set& rhs, size_t threads = 1) {
+        if (!sameShape(lhs, rhs)) {
+            ADS_set result;
+            lhs.for_each([&result, &rhs](const key_type& key) {
+                if (!rhs.count(key)) result.insert(key);
+            });
+            return result;
+        }
+        return combineSlots(lhs, 0, threads, [&lhs, &rhs](ADS_set& result, size_t j, size_t i, Bucket*& tail) {
+            const Bucket* other = rhs.head(i);
+            return result.appendTo(j, tail, lhs, lhs.head(i), [&rhs, other](const key_type& key) {
+                return !rhs.chainContains(other, key);
+            });
+        });
+    }
 };
 
-template<typename Key, size_t N>
-class ADS_set<Key, N>::Iterator {
+template<typename Key, size_t N, typename Layout>
+class ADS_set<Key, N, Layout>::Iterator {
 private:
-    ADS_set<Key, N>::PrivateBucketIterator beginIterator_;
-    ADS_set<Key, N>::PrivateBucketIterator endIterator_;
-    ADS_set<Key, N>::Bucket* position_;
+    friend class ADS_set<Key, N, Layout>;
+
+    const ADS_set<Key, N, Layout>* set_;
+    size_t bucketIndex_;
+    ADS_set<Key, N, Layout>::Bucket* position_;
     size_t index_;
 
 public:
     void advanceToNext() {
-        for (size_t i = index_ + 1; i < position_->nextFreeIndex; ++i) {
-            index_ = i;
-            return;
-        }
-
-        position_ = position_->overflowBucket;
-        while (position_) {
-            index_ = 0;
-            for (size_t i = index_; i < position_->nextFreeIndex; ++i) {
-                index_ = i;
-                return;
-            }
-            position_ = position_->overflowBucket;
-        }
+        if (++index_ < position_->nextFreeIndex) return;
 
-        for (++beginIterator_; beginIterator_ != endIterator_; ++beginIterator_) {
-            position_ = &(*beginIterator_);
-            while (position_) {
-                index_ = 0;
-                for (size_t i = index_; i < position_->nextFreeIndex; ++i) {
-                    index_ = i;
-                    return;
-                }
-                position_ = position_->overflowBucket;
-            }
+        index_ = 0;
+        for (position_ = set_->next(position_); position_; position_ = set_->next(position_)) {
+            if (position_->nextFreeIndex) return;
         }
 
-        index_ = (size_t)-1;
+        *this = set_->firstIn(set_->nextOccupied(bucketIndex_ + 1));
     }
     using value_type = Key;
     using difference_type = std::ptrdiff_t;
     using reference = const value_type &;
     using pointer = const value_type *;
     using iterator_category = std::forward_iterator_tag;
-    using BucketIterator = ADS_set<Key, N>::PrivateBucketIterator;
-    using Bucket = ADS_set<Key, N>::Bucket;
+    using Bucket = ADS_set<Key, N, Layout>::Bucket;
 
     Iterator()
-        : beginIterator_{BucketIterator(nullptr, 0, 0)}
-        , endIterator_{BucketIterator(nullptr, 0, 0)}
+        : set_{nullptr}
+        , bucketIndex_{0}
         , position_{nullptr}
-        , index_{(size_t)-1}
+        , index_{SIZE_INVALID}
     {
 
     }
 
-    explicit Iterator(BucketIterator beginIt, BucketIterator endIt, Bucket* position, size_t index)
-            : beginIterator_{beginIt}
-            , endIterator_{endIt}
+    explicit Iterator(const ADS_set<Key, N, Layout>* set, size_t bucketIndex, Bucket* position, size_t index)
+            : set_{set}
+            , bucketIndex_{bucketIndex}
             , position_{position}
             , index_{index}
     {
@@ -494,7 +1950,60 @@ public:
     friend bool operator!=(const Iterator& lhs, const Iterator& rhs) { return !(lhs == rhs); };
 };
 
-template<typename Key, size_t N>
-void swap(ADS_set<Key, N> &lhs, ADS_set<Key, N> &rhs) { lhs.swap(rhs); }
+// Node handle of extract(): owns one key moved out of a set
+template<typename Key, size_t N, typename Layout>
+class ADS_set<Key, N, Layout>::Node {
+private:
+    friend class ADS_set<Key, N, Layout>;
+    union {
+        Key key_;
+    };
+    bool empty_;
+
+    explicit Node(Key&& key): key_(std::move(key)), empty_{false} {}
+
+    void reset() {
+        if (!empty_) key_.~Key();
+        empty_ = true;
+    }
+
+public:
+    using value_type = Key;
+
+    Node(): empty_{true} {}
+
+    Node(Node&& other): empty_{true} {
+        if (other.empty_) return;
+        ::new (&key_) Key(std::move(other.key_));
+        empty_ = false;
+        other.reset();
+    }
+
+    Node& operator=(Node&& other) {
+        if (this == &other) return *this;
+        reset();
+        if (!other.empty_) {
+            ::new (&key_) Key(std::move(other.key_));
+            empty_ = false;
+            other.reset();
+        }
+        return *this;
+    }
+
+    ~Node() { reset(); }
+
+    bool empty() const { return empty_; }
+    explicit operator bool() const { return !empty_; }
+
+    value_type& value() { return key_; }
+    const value_type& value() const { return key_; }
+};
+
+template<typename Key, size_t N, typename Layout>
+void swap(ADS_set<Key, N, Layout> &lhs, ADS_set<Key, N, Layout> &rhs) { lhs.swap(rhs); }
+
+// Set whose buckets fill (and are aligned to) Bytes, e.g. ADS_fit_set<unsigned, 64>
+template<typename Key, size_t Bytes>
+using ADS_fit_set = ADS_set<Key, ADS_fit<Key, Bytes>::value, ADS_fit_layout<Bytes>>;
 
 #endif // ADS_SET_H
\ No newline at end of file
@@ -0,0 +1,102 @@
+// Content test for set_union(), set_intersection() and set_difference()
+//
+// Random operands of many sizes, from sets that fit the inline bucket to
+// ones of many rounds, with a shared part so that every operation has work
+// on both sides. Each result is compared key by key with the std::set_*
+// algorithms on sorted copies, with 1 and several threads, for every layout.
+//
+// g++ -Wall -Wextra -O2 --std=c++14 -pthread algebratest.cpp -o algebratest && ./algebratest
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ADS_set.h"
+#include "testutil.h"
+
+// lhs and rhs hold na and nb random keys, about half of the smaller one shared
+template<typename Set>
+int check(const char* name, size_t na, size_t nb, std::mt19937_64& random) {
+    using Key = typename Set::key_type;
+    std::set<Key> a, b;
+    size_t range = 4 * (na + nb) + 8;
+    while (a.size() < na) a.insert(make_key<Key>(random() % range));
+    for (const auto& key: a) {
+        if (b.size() < nb / 2 && random() % 2) b.insert(key);
+    }
+    while (b.size() < nb) b.insert(make_key<Key>(random() % range));
+    Set lhs{a.begin(), a.end()}, rhs{b.begin(), b.end()};
+
+    std::set<Key> both, common, only;
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::inserter(both, both.end()));
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::inserter(common, common.end()));
+    std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::inserter(only, only.end()));
+
+    std::string shape = std::string(name) + " " + std::to_string(na) + " and " + std::to_string(nb) + " keys";
+    int errors = 0;
+    for (size_t threads: {1, 4}) {
+        std::string what = shape + ", " + std::to_string(threads) + " threads: ";
+        if (!same(set_union(lhs, rhs, threads), both)) errors += fail(what + "set_union");
+        if (!same(set_intersection(lhs, rhs, threads), common)) errors += fail(what + "set_intersection");
+        if (!same(set_difference(lhs, rhs, threads), only)) errors += fail(what + "set_difference");
+        // the results must stay usable: grow one past its directory
+        Set grown = set_union(lhs, rhs, threads);
+        for (size_t i = 0; i < 100; ++i) {
+            Key key = make_key<Key>(range + i);
+            grown.insert(key);
+            both.insert(key);
+        }
+        if (!same(grown, both)) errors += fail(what + "inserts into set_union");
+        for (size_t i = 0; i < 100; ++i) {
+            both.erase(make_key<Key>(range + i));
+        }
+    }
+    return errors;
+}
+
+template<typename Set>
+int check_sizes(const char* name, std::mt19937_64& random) {
+    int errors = 0;
+    for (size_t na: {0, 1, 2, 3, 4, 7, 50, 1000, 20000}) {
+        for (size_t nb: {0, 1, 3, 5, 1000, 20000}) {
+            errors += check<Set>(name, na, nb, random);
+        }
+    }
+    return errors;
+}
+
+int main() {
+    std::mt19937_64 random{5};
+    int errors = 0;
+
+    errors += check_sizes<ADS_set<unsigned>>("default", random);
+    errors += check_sizes<ADS_set<unsigned, 1>>("default N=1", random);
+    errors += check_sizes<ADS_set<unsigned, 16>>("default N=16", random);
+    errors += check_sizes<ADS_set<std::string>>("default strings", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_compact_layout>>("compact", random);
+    errors += check_sizes<ADS_set<std::string, 3, ADS_compact_layout>>("compact strings", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_fit_layout<64>>>("cache line", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_sorted_layout<>>>("sorted", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_filter_layout<>>>("filter", random);
+    errors += check_sizes<ADS_set<std::string, 3, ADS_sorted_layout<ADS_filter_layout<>>>>("sorted, filter strings", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_deamortized_layout<>>>("deamortized", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_deferred_layout<>>>("deferred", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_split_layout<ADS_overflow_split>>>("split on overflow", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_split_layout<ADS_chain_split<2>>>>("split at chain 2", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_partial_layout<>>>("partial", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_partial_layout<ADS_compact_layout>>>("partial compact", random);
+    errors += check_sizes<ADS_set<unsigned, 1, ADS_partial_layout<>>>("partial N=1", random);
+    errors += check_sizes<ADS_set<std::string, 3, ADS_partial_layout<>>>("partial strings", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_spiral_layout<>>>("spiral", random);
+    errors += check_sizes<ADS_set<unsigned, 1, ADS_spiral_layout<>>>("spiral N=1", random);
+    errors += check_sizes<ADS_set<std::string, 3, ADS_spiral_layout<>>>("spiral strings", random);
+    errors += check_sizes<ADS_set<unsigned, 3, ADS_spiral_layout<ADS_compact_layout>>>("spiral compact", random);
+
+    if (errors) return 1;
+    std::cout << "OK\n";
+    return 0;
+}
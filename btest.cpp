@@ -14,6 +14,7 @@
 #include <set>
 #include <sstream>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 #include <stdlib.h>
@@ -56,6 +57,9 @@
 // }}}
 
 #include "ADS_set.h"
+#ifdef EXTENDIBLE
+#include "extendible_ads_set.h"
+#endif
 
 #define PH2
 
@@ -132,13 +136,66 @@ namespace std {
     };
 }
 
+// Layout switches, in any combination: -DCOMPACT, -DSORTED, -DFILTER,
+// -DDEAMORTIZED, -DDEFERRED, -DPARTIAL or -DSPIRAL, and -DSPLIT=<policy>,
+// e.g. -DSPLIT=ADS_overflow_split or -DSPLIT='ADS_chain_split<2>'.
+// -DEXTENDIBLE runs everything against extendible_ads_set instead, with
+// -DDIRECTORY=<policy>, e.g. -DDIRECTORY='extendible_capped_directory<4>'.
+// The stresstests insert sequential keys, which the identity hash of linear
+// hashing keeps local; with the mixed hashes of partial, spiral and
+// extendible they need -O2 to stay within their time limits, and spiral with
+// -DSIZE=1 misses the limit of the first one even then. So does the
+// unbounded extendible directory below -DSIZE=8; at -DSIZE=1 it cannot hold
+// the keys at all, capped it can.
+#ifndef COMPACT
+#define COMPACT 0
+#endif
+#ifndef SORTED
+#define SORTED 0
+#endif
+#ifndef FILTER
+#define FILTER 0
+#endif
+#ifndef DEAMORTIZED
+#define DEAMORTIZED 0
+#endif
+#ifndef DEFERRED
+#define DEFERRED 0
+#endif
+#ifndef PARTIAL
+#define PARTIAL 0
+#endif
+#ifndef SPIRAL
+#define SPIRAL 0
+#endif
+#ifndef SIZE
+#define SIZE 3
+#endif
+
 namespace ads {
+    template <bool On, template <class> class Layer, class Base>
+    using layer = typename std::conditional<On, Layer<Base>, Base>::type;
+
+    using base_layout = typename std::conditional<COMPACT, ADS_compact_layout, ADS_default_layout>::type;
+    using layout = layer<SPIRAL, ADS_spiral_layout, layer<PARTIAL, ADS_partial_layout,
+                   layer<DEFERRED, ADS_deferred_layout, layer<DEAMORTIZED, ADS_deamortized_layout,
+                   layer<FILTER, ADS_filter_layout, layer<SORTED, ADS_sorted_layout, base_layout>>>>>>;
+#ifdef SPLIT
+    using split_layout = ADS_split_layout<SPLIT, layout>;
+#else
+    using split_layout = layout;
+#endif
+
     template <class T>
     using set =
-#ifdef SIZE
-    ADS_set<T, SIZE>;
+#ifdef EXTENDIBLE
+#ifdef DIRECTORY
+    extendible_ads_set<T, SIZE, DIRECTORY>;
+#else
+    extendible_ads_set<T, SIZE>;
+#endif
 #else
-    ADS_set<T>;
+    ADS_set<T, SIZE, split_layout>;
 #endif
 }
 
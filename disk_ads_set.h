@@ -0,0 +1,397 @@
+#ifndef DISK_ADS_SET_H
+#define DISK_ADS_SET_H
+
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Linear hashing on external storage. Every bucket is one PageSize page;
+// primary buckets live in `path` (page i + 1 holds slot i, page 0 the meta
+// data), overflow buckets in `path.overflow`, chained by page id. Slots are
+// addressed from d_/nextToSplit_ exactly like ADS_set::bucketAddress(), so no
+// directory is stored. Pages are cached in a fixed size buffer pool with
+// CLOCK replacement; dirty pages are written back on eviction and flush().
+template<typename Key, size_t PageSize = 4096>
+class disk_ads_set {
+public:
+    using value_type = Key;
+    using key_type = Key;
+    using reference = const key_type &;
+    using const_reference = const key_type &;
+    using size_type = size_t;
+    using key_equal = std::equal_to<key_type>;
+    using hasher = std::hash<key_type>;
+
+    static_assert(std::is_trivially_copyable<Key>::value, "disk_ads_set stores keys as raw bytes");
+
+    struct io_stats {
+        size_t reads{0};
+        size_t writes{0};
+        size_t hits{0};
+        size_t misses{0};
+    };
+
+private:
+    using page_id = uint64_t;
+    // set on ids of pages in the overflow file, 0 terminates a chain
+    static const page_id OVERFLOW_PAGE = page_id(1) << 63;
+
+    struct PageHeader {
+        uint32_t count;
+        uint32_t reserved;
+        page_id overflow;
+    };
+
+    struct Meta {
+        char magic[4];
+        uint32_t version;
+        uint32_t keySize;
+        uint32_t pageSize;
+        uint64_t d;
+        uint64_t nextToSplit;
+        uint64_t tableSize;
+        uint64_t size;
+        uint64_t overflowPages;
+        page_id freeOverflow;
+    };
+
+public:
+    static const size_t CAPACITY = (PageSize - sizeof(PageHeader)) / sizeof(Key);
+    static_assert(CAPACITY >= 1, "PageSize too small for a single key");
+    static_assert(sizeof(Meta) <= PageSize, "PageSize too small for the meta page");
+
+private:
+    struct Page {
+        PageHeader header;
+        Key keys[CAPACITY];
+    };
+
+    struct Frame {
+        page_id id;
+        bool used;
+        bool dirty;
+        bool referenced;
+    };
+
+    static const uint32_t VERSION = 1;
+
+    int primaryFd_{-1};
+    int overflowFd_{-1};
+    Meta meta_;
+    float maxLoadFactor_{0.9};
+
+    std::vector<char> memory_;
+    std::vector<Frame> frames_;
+    std::unordered_map<page_id, size_t> resident_;
+    size_t hand_{0};
+    io_stats stats_;
+
+    int fdOf(page_id id) const { return id & OVERFLOW_PAGE ? overflowFd_ : primaryFd_; }
+
+    off_t offsetOf(page_id id) const {
+        return off_t(id & OVERFLOW_PAGE ? id & ~OVERFLOW_PAGE : id + 1) * off_t(PageSize);
+    }
+
+    Page* frame(size_t index) { return reinterpret_cast<Page*>(&memory_[index * PageSize]); }
+
+    void readRaw(int fd, off_t offset, char* buffer) {
+        size_t done = 0;
+        while (done < PageSize) {
+            ssize_t n = pread(fd, buffer + done, PageSize - done, offset + off_t(done));
+            if (n < 0) throw std::runtime_error("disk_ads_set: read failed");
+            // past the end of file pages read as empty
+            if (n == 0) {
+                std::memset(buffer + done, 0, PageSize - done);
+                break;
+            }
+            done += size_t(n);
+        }
+    }
+
+    void writeRaw(int fd, off_t offset, const char* buffer) {
+        size_t done = 0;
+        while (done < PageSize) {
+            ssize_t n = pwrite(fd, buffer + done, PageSize - done, offset + off_t(done));
+            if (n <= 0) throw std::runtime_error("disk_ads_set: write failed");
+            done += size_t(n);
+        }
+    }
+
+    // CLOCK: a referenced frame gets a second chance, the first unreferenced
+    // one is written back if dirty and reused.
+    size_t evict() {
+        for (;;) {
+            size_t index = hand_;
+            Frame& f = frames_[index];
+            hand_ = (hand_ + 1) % frames_.size();
+            if (!f.used) return index;
+            if (f.referenced) {
+                f.referenced = false;
+                continue;
+            }
+            if (f.dirty) {
+                writeRaw(fdOf(f.id), offsetOf(f.id), reinterpret_cast<const char*>(frame(index)));
+                ++stats_.writes;
+            }
+            resident_.erase(f.id);
+            f.used = false;
+            return index;
+        }
+    }
+
+    // The returned page stays valid until the next fetch().
+    Page* fetch(page_id id, bool write = false) {
+        auto it = resident_.find(id);
+        size_t index;
+        if (it != resident_.end()) {
+            ++stats_.hits;
+            index = it->second;
+        } else {
+            ++stats_.misses;
+            index = evict();
+            readRaw(fdOf(id), offsetOf(id), reinterpret_cast<char*>(frame(index)));
+            ++stats_.reads;
+            frames_[index] = Frame{id, true, false, false};
+            resident_[id] = index;
+        }
+        frames_[index].referenced = true;
+        frames_[index].dirty |= write;
+        return frame(index);
+    }
+
+    Page* fetchEmpty(page_id id) {
+        Page* page = fetch(id, true);
+        page->header = PageHeader{0, 0, 0};
+        return page;
+    }
+
+    page_id allocateOverflow() {
+        page_id id = meta_.freeOverflow;
+        if (id) {
+            meta_.freeOverflow = fetch(id)->header.overflow;
+        } else {
+            id = OVERFLOW_PAGE | ++meta_.overflowPages;
+        }
+        fetchEmpty(id);
+        return id;
+    }
+
+    void releaseOverflow(page_id id) {
+        Page* page = fetchEmpty(id);
+        page->header.overflow = meta_.freeOverflow;
+        meta_.freeOverflow = id;
+    }
+
+    size_t tableSize() const { return size_t(meta_.tableSize); }
+
+    size_t bucketAddress(const Key& key) const {
+        size_t n = hasher{}(key);
+        size_t d = size_t(meta_.d);
+        if (n % (size_t(1) << d) >= meta_.nextToSplit)
+            return n % (size_t(1) << d);
+        else
+            return n % (size_t(1) << (d + 1));
+    }
+
+    // Rewrites chain with keys, reusing its pages first; chain[0] is the
+    // primary page. Pages left over go to the free list.
+    void writeChain(std::vector<page_id>& chain, const std::vector<Key>& keys) {
+        size_t pages = std::max<size_t>(1, (keys.size() + CAPACITY - 1) / CAPACITY);
+        while (chain.size() < pages) {
+            chain.push_back(allocateOverflow());
+        }
+        for (size_t p = 0; p < pages; ++p) {
+            Page* page = fetch(chain[p], true);
+            size_t first = p * CAPACITY;
+            size_t n = std::min(first + CAPACITY, keys.size()) - first;
+            std::copy(keys.begin() + first, keys.begin() + first + n, page->keys);
+            page->header.count = uint32_t(n);
+            page->header.overflow = p + 1 < pages ? chain[p + 1] : 0;
+        }
+        for (size_t p = pages; p < chain.size(); ++p) {
+            releaseOverflow(chain[p]);
+        }
+    }
+
+    void rehash(size_t index) {
+        std::vector<page_id> chain;
+        std::vector<Key> stay, moved;
+        for (page_id id = index; ; ) {
+            chain.push_back(id);
+            Page* page = fetch(id);
+            for (size_t i = 0; i < page->header.count; ++i) {
+                (bucketAddress(page->keys[i]) == index ? stay : moved).push_back(page->keys[i]);
+            }
+            id = page->header.overflow;
+            if (!id) break;
+        }
+
+        writeChain(chain, stay);
+        std::vector<page_id> target{page_id(index + (size_t(1) << meta_.d))};
+        writeChain(target, moved);
+    }
+
+    void split() {
+        fetchEmpty(page_id(meta_.tableSize++));
+        rehash(size_t(meta_.nextToSplit++));
+        if ((uint64_t(1) << meta_.d) == meta_.nextToSplit) {
+            ++meta_.d;
+            meta_.nextToSplit = 0;
+        }
+    }
+
+    void reserve(size_t n) {
+        if (n / float(CAPACITY * tableSize()) > maxLoadFactor_) {
+            split();
+        }
+    }
+
+    void writeMeta() {
+        std::vector<char> page(PageSize, 0);
+        std::memcpy(page.data(), &meta_, sizeof(meta_));
+        writeRaw(primaryFd_, 0, page.data());
+        ++stats_.writes;
+    }
+
+    void close() {
+        if (primaryFd_ >= 0) ::close(primaryFd_);
+        if (overflowFd_ >= 0) ::close(overflowFd_);
+        primaryFd_ = overflowFd_ = -1;
+    }
+
+public:
+    // Opens the set stored at path, creating it if the file does not exist.
+    explicit disk_ads_set(const std::string& path, size_t poolPages = 1024)
+            : memory_(std::max<size_t>(1, poolPages) * PageSize)
+            , frames_(std::max<size_t>(1, poolPages), Frame{0, false, false, false})
+    {
+        primaryFd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        overflowFd_ = ::open((path + ".overflow").c_str(), O_RDWR | O_CREAT, 0644);
+        if (primaryFd_ < 0 || overflowFd_ < 0) {
+            close();
+            throw std::runtime_error("disk_ads_set: cannot open " + path);
+        }
+
+        std::vector<char> page(PageSize);
+        readRaw(primaryFd_, 0, page.data());
+        std::memcpy(&meta_, page.data(), sizeof(meta_));
+        if (0 == meta_.version) {
+            meta_ = Meta{{'A', 'D', 'S', 'P'}, VERSION, uint32_t(sizeof(Key)), uint32_t(PageSize), 2, 0, 4, 0, 0, 0};
+        } else if (0 != std::memcmp(meta_.magic, "ADSP", 4) || VERSION != meta_.version
+                   || sizeof(Key) != meta_.keySize || PageSize != meta_.pageSize) {
+            close();
+            throw std::runtime_error("disk_ads_set: " + path + " holds an incompatible set");
+        }
+    }
+
+    disk_ads_set(const disk_ads_set&) = delete;
+    disk_ads_set& operator=(const disk_ads_set&) = delete;
+
+    ~disk_ads_set() {
+        try {
+            flush();
+        } catch (...) {
+        }
+        close();
+    }
+
+    size_type size() const { return size_t(meta_.size); }
+
+    bool empty() const { return !size(); }
+
+    size_type count(const key_type& key) {
+        for (page_id id = bucketAddress(key); ; ) {
+            Page* page = fetch(id);
+            for (size_t i = 0; i < page->header.count; ++i) {
+                if (key_equal{}(key, page->keys[i])) return 1;
+            }
+            id = page->header.overflow;
+            if (!id) return 0;
+        }
+    }
+
+    bool insert(const key_type& key) {
+        if (count(key)) return false;
+        reserve(size() + 1);
+
+        page_id id = bucketAddress(key);
+        for (Page* page = fetch(id); page->header.count == CAPACITY; page = fetch(id)) {
+            page_id next = page->header.overflow;
+            if (!next) {
+                next = allocateOverflow();
+                fetch(id, true)->header.overflow = next;
+            }
+            id = next;
+        }
+        Page* page = fetch(id, true);
+        page->keys[page->header.count++] = key;
+        ++meta_.size;
+        return true;
+    }
+
+    size_type erase(const key_type& key) {
+        for (page_id id = bucketAddress(key); ; ) {
+            Page* page = fetch(id);
+            for (size_t i = 0; i < page->header.count; ++i) {
+                if (key_equal{}(key, page->keys[i])) {
+                    page = fetch(id, true);
+                    page->keys[i] = page->keys[--page->header.count];
+                    --meta_.size;
+                    return 1;
+                }
+            }
+            id = page->header.overflow;
+            if (!id) return 0;
+        }
+    }
+
+    template<typename F>
+    void for_each(F&& f) {
+        for (size_t index = 0; index < tableSize(); ++index) {
+            for (page_id id = index; ; ) {
+                Page* page = fetch(id);
+                // copy out, f may not keep the page pinned
+                Key keys[CAPACITY];
+                size_t n = page->header.count;
+                std::copy(page->keys, page->keys + n, keys);
+                id = page->header.overflow;
+                for (size_t i = 0; i < n; ++i) f(const_cast<const Key&>(keys[i]));
+                if (!id) break;
+            }
+        }
+    }
+
+    // Writes back all dirty pages and the meta data; with sync also fsyncs.
+    void flush(bool sync = false) {
+        for (size_t i = 0; i < frames_.size(); ++i) {
+            if (frames_[i].used && frames_[i].dirty) {
+                writeRaw(fdOf(frames_[i].id), offsetOf(frames_[i].id), reinterpret_cast<const char*>(frame(i)));
+                ++stats_.writes;
+                frames_[i].dirty = false;
+            }
+        }
+        writeMeta();
+        if (sync && (fsync(overflowFd_) != 0 || fsync(primaryFd_) != 0))
+            throw std::runtime_error("disk_ads_set: fsync failed");
+    }
+
+    size_t pool_pages() const { return frames_.size(); }
+    size_t file_pages() const { return tableSize() + size_t(meta_.overflowPages); }
+
+    const io_stats& stats() const { return stats_; }
+    void reset_stats() { stats_ = io_stats{}; }
+};
+
+template<typename Key, size_t PageSize>
+const size_t disk_ads_set<Key, PageSize>::CAPACITY;
+
+#endif // DISK_ADS_SET_H
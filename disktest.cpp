@@ -0,0 +1,150 @@
+// Test for disk_ads_set.h
+//
+// Random inserts and erases with 64 byte pages and a buffer pool of two or
+// three pages, so nearly every access evicts, are checked against std::set
+// while the set runs and after it is closed and opened again. Keys that all
+// land in one slot build overflow chains; once a split rewrites such a
+// chain its pages go to the free list, and new overflow pages must come
+// from there instead of growing the overflow file.
+//
+// g++ -Wall -Wextra -O2 --std=c++14 disktest.cpp -o disktest && ./disktest
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "disk_ads_set.h"
+#include "testutil.h"
+
+const std::string PATH = "disktest.pages";
+
+using disk_set = disk_ads_set<unsigned, 64>;
+
+void remove_files() {
+    std::remove(PATH.c_str());
+    std::remove((PATH + ".overflow").c_str());
+}
+
+size_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? size_t(st.st_size) : 0;
+}
+
+// size(), count() and for_each() against expected
+int check(disk_set& set, const std::set<unsigned>& expected, const std::string& what) {
+    if (set.size() != expected.size()) return fail(what + ": size");
+    for (unsigned key: expected) {
+        if (!set.count(key)) return fail(what + ": missing key " + std::to_string(key));
+    }
+    std::set<unsigned> seen;
+    size_t n = 0;
+    set.for_each([&](unsigned key) {
+        seen.insert(key);
+        ++n;
+    });
+    if (n != expected.size() || seen != expected) return fail(what + ": for_each");
+    return 0;
+}
+
+int churn(size_t poolPages, unsigned seed) {
+    int errors = 0;
+    std::string what = "pool of " + std::to_string(poolPages) + " pages";
+    remove_files();
+    std::mt19937 random{seed};
+    std::set<unsigned> expected;
+    {
+        disk_set set{PATH, poolPages};
+        for (size_t i = 0; i < 20000; ++i) {
+            // a small key range makes erases hit; every 8th key collides in slot 0
+            unsigned key = random() % 8 ? unsigned(random() % 6000) : unsigned(random() % 64) << 24;
+            if (random() % 3) {
+                if (set.insert(key) != expected.insert(key).second) errors += fail(what + ": insert result");
+            } else {
+                if (set.erase(key) != expected.erase(key)) errors += fail(what + ": erase result");
+            }
+            if (random() % 1000 == 0 && set.count(key) != expected.count(key)) errors += fail(what + ": count");
+        }
+        errors += check(set, expected, what);
+        if (set.stats().misses < set.stats().hits / 10) errors += fail(what + ": the pool did not evict");
+    }
+    // closed, reopened with another pool size
+    {
+        disk_set set{PATH, poolPages + 5};
+        errors += check(set, expected, what + ", reopened");
+        for (unsigned key: expected) {
+            if (key % 2) set.erase(key);
+        }
+        for (unsigned key = 6000; key < 6500; ++key) {
+            set.insert(key);
+        }
+    }
+    for (auto it = expected.begin(); it != expected.end();) {
+        it = *it % 2 ? expected.erase(it) : std::next(it);
+    }
+    for (unsigned key = 6000; key < 6500; ++key) {
+        expected.insert(key);
+    }
+    {
+        disk_set set{PATH, 2};
+        errors += check(set, expected, what + ", reopened twice");
+    }
+    return errors;
+}
+
+int overflow_reuse() {
+    int errors = 0;
+    remove_files();
+    disk_set set{PATH, 3};
+    std::set<unsigned> expected;
+    // 40 keys in slot 0: its page and 3 overflow pages, then emptied
+    for (unsigned i = 1; i <= 40; ++i) {
+        set.insert(i << 24);
+    }
+    for (unsigned i = 1; i <= 40; ++i) {
+        set.erase(i << 24);
+    }
+    set.flush();
+    size_t overflowBytes = file_size(PATH + ".overflow");
+    // spread keys until the first split, which rewrites slot 0 and frees
+    // its empty pages; 11 keys per slot need no overflow pages
+    size_t pages = set.file_pages();
+    for (unsigned key = 1; set.file_pages() == pages; ++key) {
+        set.insert(key);
+        expected.insert(key);
+    }
+    // another chain, of 41 keys in slot 3, takes 3 overflow pages
+    for (unsigned i = 1; i <= 30; ++i) {
+        set.insert(i << 24 | 3);
+        expected.insert(i << 24 | 3);
+    }
+    set.flush();
+    if (file_size(PATH + ".overflow") != overflowBytes) errors += fail("overflow pages not reused");
+    errors += check(set, expected, "overflow reuse");
+    return errors;
+}
+
+int main() {
+    int errors = 0;
+
+    for (size_t pool: {2, 3}) {
+        errors += churn(pool, unsigned(pool));
+    }
+    errors += overflow_reuse();
+
+    // a file of 4 byte keys does not open as one of 8 byte keys
+    try {
+        disk_ads_set<uint64_t, 64> wide{PATH, 2};
+        errors += fail("opened with another key size");
+    } catch (const std::runtime_error&) {
+    }
+
+    remove_files();
+    if (errors) return 1;
+    std::cout << "OK\n";
+    return 0;
+}
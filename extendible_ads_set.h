@@ -0,0 +1,494 @@
+#ifndef EXTENDIBLE_ADS_SET_H
+#define EXTENDIBLE_ADS_SET_H
+
+#include <functional>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+// Directory policies of extendible_ads_set.
+//
+// entries_per_bucket: the directory doubles only while it has fewer than this
+// many entries per bucket, and a full bucket that may not split takes an
+// overflow bucket instead; 0 never limits the directory.
+struct extendible_unbounded_directory {
+    static const size_t entries_per_bucket = 0;
+};
+
+// Even with random hashes the directory outgrows the keys, the more the
+// smaller the buckets: for buckets of 3 keys it has 2^26 entries at 1M keys.
+// This caps it at EntriesPerBucket entries per bucket, at the price of
+// overflow buckets and of lookups that may read more than one bucket.
+template<size_t EntriesPerBucket = 4>
+struct extendible_capped_directory {
+    static_assert(EntriesPerBucket > 1, "a directory of one entry per bucket could never double");
+    static const size_t entries_per_bucket = EntriesPerBucket;
+};
+
+// Extendible hashing (Fagin et al.) with the interface of ADS_set. The
+// directory has 2^globalDepth entries, entry i pointing to the bucket of the
+// keys whose mixed hash ends in the bits of i. A bucket of local depth l is
+// shared by the 2^(globalDepth - l) entries that agree in their low l bits.
+// A full bucket splits by bit l of its keys' mixed hashes, doubling the
+// directory first if l is the global depth, until the key fits, so there
+// are no overflow chains and every lookup reads one directory entry and one
+// bucket. Hashes are mixed like ADS_set's, so keys sharing their low bits
+// (i << 24 under the identity std::hash) spread as well. More than N keys
+// with one mixed hash make insert() throw. Directory may cap the directory
+// instead, see extendible_capped_directory. Erased keys leave their buckets
+// in place, as in ADS_set.
+//
+// All buckets are also linked in one list, in the order they were allocated,
+// which iteration follows: it costs the buckets, not the directory entries,
+// and reads them about in the order they lie in memory.
+template<typename Key, size_t N = 3, typename Directory = extendible_unbounded_directory>
+class extendible_ads_set {
+public:
+    class Iterator;
+    using value_type = Key;
+    using key_type = Key;
+    using reference = key_type &;
+    using const_reference = const key_type &;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+    using key_equal = std::equal_to<key_type>;
+    using hasher = std::hash<key_type>;
+
+    static_assert(N > 0, "buckets hold at least one key");
+
+private:
+    static const size_t entriesPerBucket = Directory::entries_per_bucket;
+
+    // keys[i] is constructed only for i < count. bits are the low localDepth
+    // bits the mixed hashes of its keys share, its first directory entry;
+    // overflow buckets copy both from the first bucket of their chain.
+    struct Bucket {
+        size_t localDepth;
+        size_t bits;
+        size_t count{0};
+        Bucket* next{nullptr};
+        Bucket* overflow{nullptr};
+        union {
+            Key keys[N];
+        };
+
+        Bucket(size_t depth, size_t bits): localDepth{depth}, bits{bits} {}
+
+        // Copies the keys, not the links
+        Bucket(const Bucket& other): localDepth{other.localDepth}, bits{other.bits} {
+            try {
+                for (; count < other.count; ++count) {
+                    ::new (keys + count) Key(other.keys[count]);
+                }
+            } catch (...) {
+                clear();
+                throw;
+            }
+        }
+
+        ~Bucket() { clear(); }
+
+        void clear() {
+            for (size_t i = 0; i < count; ++i) {
+                keys[i].~Key();
+            }
+            count = 0;
+        }
+
+        size_t indexOf(const Key& key) const {
+            for (size_t i = 0; i < count; ++i) {
+                if (key_equal{}(keys[i], key)) return i;
+            }
+            return N;
+        }
+
+        // the last key takes the place of key i
+        void remove(size_t i) {
+            if (i != --count) keys[i] = std::move(keys[count]);
+            keys[count].~Key();
+        }
+    };
+
+    Bucket** directory_{nullptr};
+    Bucket* first_{nullptr};
+    Bucket* last_{nullptr};
+    // overflow buckets emptied by splits, linked through overflow; they stay
+    // in the list of all buckets
+    Bucket* spare_{nullptr};
+    size_t globalDepth_{0};
+    size_t buckets_{0};
+    size_t size_{0};
+
+    // The 64 bit finalizer of MurmurHash3, as ADS_set::addressMix()
+    static size_t mix(size_t hash) {
+        uint64_t y = hash;
+        y ^= y >> 33;
+        y *= 0xff51afd7ed558ccdull;
+        y ^= y >> 33;
+        y *= 0xc4ceb9fe1a85ec53ull;
+        return size_t(y ^ y >> 33);
+    }
+
+    size_t directorySize() const { return size_t(1) << globalDepth_; }
+
+    Bucket* bucketOf(size_t hash) const { return directory_[hash & (directorySize() - 1)]; }
+
+    // The bucket of the chain that holds key and its index there in *i,
+    // else nullptr
+    static Bucket* locate(Bucket* bucket, const Key& key, size_t* i) {
+        for (; bucket; bucket = bucket->overflow) {
+            if (N != (*i = bucket->indexOf(key))) return bucket;
+        }
+        return nullptr;
+    }
+
+    // First key at or after bucket in the list, else end()
+    static iterator firstFrom(const Bucket* bucket) {
+        for (; bucket; bucket = bucket->next) {
+            if (bucket->count) return iterator{bucket, 0};
+        }
+        return iterator{};
+    }
+
+    // Appends bucket to the list of all buckets
+    Bucket* link(Bucket* bucket) {
+        (last_ ? last_->next : first_) = bucket;
+        return last_ = bucket;
+    }
+
+    Bucket* newBucket(size_t depth, size_t bits) {
+        Bucket* bucket = spare_;
+        if (!bucket) return link(new Bucket{depth, bits});
+        spare_ = bucket->overflow;
+        bucket->overflow = nullptr;
+        bucket->localDepth = depth;
+        bucket->bits = bits;
+        return bucket;
+    }
+
+    void release() {
+        while (Bucket* bucket = first_) {
+            first_ = bucket->next;
+            delete bucket;
+        }
+        last_ = spare_ = nullptr;
+        delete[] directory_;
+        directory_ = nullptr;
+    }
+
+    void grow() {
+        if (globalDepth_ + 1 >= sizeof(size_t) * 8)
+            throw std::runtime_error("extendible_ads_set: directory exhausted");
+        size_t n = directorySize();
+        Bucket** directory = new Bucket*[2 * n];
+        std::copy(directory_, directory_ + n, directory);
+        std::copy(directory_, directory_ + n, directory + n);
+        delete[] directory_;
+        directory_ = directory;
+        ++globalDepth_;
+    }
+
+    static bool full(const Bucket* bucket) {
+        for (; bucket; bucket = bucket->overflow) {
+            if (bucket->count < N) return false;
+        }
+        return true;
+    }
+
+    // Keys with one mixed hash could never be told apart by a split
+    static bool sameHash(const Bucket* bucket, size_t hash) {
+        for (; bucket; bucket = bucket->overflow) {
+            for (size_t i = 0; i < bucket->count; ++i) {
+                if (mix(hasher{}(bucket->keys[i])) != hash) return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether the full chain of bucket, which key of hash does not fit,
+    // splits or takes an overflow bucket
+    bool maySplit(const Bucket* bucket, size_t hash) const {
+        if (bucket->localDepth < globalDepth_) return true;
+        if (entriesPerBucket && directorySize() >= entriesPerBucket * buckets_) return false;
+        if (!sameHash(bucket, hash)) return true;
+        if (!entriesPerBucket) throw std::runtime_error("extendible_ads_set: more than N keys share a hash");
+        return false;
+    }
+
+    // Adds key to the first bucket of the chain with room, which may be a
+    // new overflow bucket, and returns that bucket
+    template<typename K>
+    Bucket* append(Bucket* bucket, K&& key) {
+        for (; bucket->count == N; bucket = bucket->overflow) {
+            if (!bucket->overflow) bucket->overflow = newBucket(bucket->localDepth, bucket->bits);
+        }
+        ::new (bucket->keys + bucket->count) Key(std::forward<K>(key));
+        ++bucket->count;
+        return bucket;
+    }
+
+    // Splits the bucket by its next hash bit; the keys of its overflow
+    // buckets are spread over both, and the emptied ones become spares
+    void split(Bucket* bucket) {
+        if (bucket->localDepth == globalDepth_) grow();
+
+        size_t bit = size_t(1) << bucket->localDepth;
+        Bucket* sibling = newBucket(bucket->localDepth + 1, bucket->bits | bit);
+        ++bucket->localDepth;
+        ++buckets_;
+        Bucket* chain = bucket->overflow;
+        bucket->overflow = nullptr;
+
+        size_t kept = 0;
+        for (size_t i = 0; i < bucket->count; ++i) {
+            Key& key = bucket->keys[i];
+            if (mix(hasher{}(key)) & bit) {
+                ::new (sibling->keys + sibling->count++) Key(std::move(key));
+            } else if (kept != i) {
+                ::new (bucket->keys + kept++) Key(std::move(key));
+            } else {
+                ++kept;
+                continue;
+            }
+            key.~Key();
+        }
+        bucket->count = kept;
+
+        while (chain) {
+            for (size_t i = 0; i < chain->count; ++i) {
+                append(mix(hasher{}(chain->keys[i])) & bit ? sibling : bucket, std::move(chain->keys[i]));
+            }
+            Bucket* next = chain->overflow;
+            chain->clear();
+            chain->overflow = spare_;
+            spare_ = chain;
+            chain = next;
+        }
+
+        for (size_t j = sibling->bits; j < directorySize(); j += 2 * bit) {
+            directory_[j] = sibling;
+        }
+    }
+
+    // Finds key or inserts it, hashing it once
+    std::pair<iterator, bool> insertKey(const key_type& key) {
+        size_t hash = mix(hasher{}(key)), i;
+        Bucket* bucket = bucketOf(hash);
+        if (const Bucket* at = locate(bucket, key, &i)) return {iterator{at, i}, false};
+        while (full(bucket) && maySplit(bucket, hash)) {
+            split(bucket);
+            bucket = bucketOf(hash);
+        }
+        const Bucket* at = append(bucket, key);
+        ++size_;
+        return {iterator{at, at->count - 1}, true};
+    }
+
+public:
+    extendible_ads_set() {
+        directory_ = new Bucket*[1];
+        directory_[0] = link(new Bucket{0, 0});
+        buckets_ = 1;
+    }
+
+    extendible_ads_set(std::initializer_list<key_type> ilist): extendible_ads_set{} { insert(ilist); }
+
+    template<typename InputIt>
+    extendible_ads_set(InputIt first, InputIt last): extendible_ads_set{} { insert(first, last); }
+
+    // Copies every bucket in the directory once, followed by its overflow
+    // buckets, and points the same entries at it; spares are not copied
+    extendible_ads_set(const extendible_ads_set& other)
+            : globalDepth_{other.globalDepth_}
+            , buckets_{other.buckets_}
+            , size_{other.size_}
+    {
+        directory_ = new Bucket*[directorySize()];
+        try {
+            for (const Bucket* from = other.first_; from; from = from->next) {
+                if (other.directory_[from->bits] != from) continue;
+                Bucket* bucket = link(new Bucket{*from});
+                for (size_t j = bucket->bits; j < directorySize(); j += size_t(1) << bucket->localDepth) {
+                    directory_[j] = bucket;
+                }
+                for (const Bucket* chain = from->overflow; chain; chain = chain->overflow) {
+                    bucket = bucket->overflow = link(new Bucket{*chain});
+                }
+            }
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    ~extendible_ads_set() { release(); }
+
+    extendible_ads_set& operator=(const extendible_ads_set& other) {
+        if (this == &other) return *this;
+        extendible_ads_set tmp{other};
+        swap(tmp);
+        return *this;
+    }
+
+    extendible_ads_set& operator=(std::initializer_list<key_type> ilist) {
+        extendible_ads_set tmp{ilist};
+        swap(tmp);
+        return *this;
+    }
+
+    size_type size() const { return size_; }
+
+    bool empty() const { return !size_; }
+
+    // Buckets in the directory, overflow buckets not counted; the directory
+    // has 2^global_depth() entries
+    size_type bucket_count() const { return buckets_; }
+
+    size_type global_depth() const { return globalDepth_; }
+
+    size_type count(const key_type& key) const {
+        size_t i;
+        return nullptr != locate(bucketOf(mix(hasher{}(key))), key, &i);
+    }
+
+    iterator find(const key_type& key) const {
+        size_t i;
+        const Bucket* bucket = locate(bucketOf(mix(hasher{}(key))), key, &i);
+        if (!bucket) return end();
+        return iterator{bucket, i};
+    }
+
+    // Removes all keys but keeps directory and buckets for the keys to come
+    void clear() {
+        for (Bucket* bucket = first_; bucket; bucket = bucket->next) {
+            bucket->clear();
+        }
+        size_ = 0;
+    }
+
+    void swap(extendible_ads_set& other) {
+        std::swap(directory_, other.directory_);
+        std::swap(first_, other.first_);
+        std::swap(last_, other.last_);
+        std::swap(spare_, other.spare_);
+        std::swap(globalDepth_, other.globalDepth_);
+        std::swap(buckets_, other.buckets_);
+        std::swap(size_, other.size_);
+    }
+
+    void insert(std::initializer_list<key_type> ilist) { insert(ilist.begin(), ilist.end()); }
+
+    std::pair<iterator, bool> insert(const key_type& key) { return insertKey(key); }
+
+    template<typename InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (auto it = first; it != last; ++it) {
+            insertKey(*it);
+        }
+    }
+
+    size_type erase(const key_type& key) {
+        size_t i;
+        Bucket* bucket = locate(bucketOf(mix(hasher{}(key))), key, &i);
+        if (!bucket) return 0;
+        bucket->remove(i);
+        --size_;
+        return 1;
+    }
+
+    // Internal iteration: f(key) for every key, in iteration order
+    template<typename F>
+    void for_each(F&& f) const {
+        for (const Bucket* bucket = first_; bucket; bucket = bucket->next) {
+            for (size_t j = 0; j < bucket->count; ++j) {
+                f(bucket->keys[j]);
+            }
+        }
+    }
+
+    const_iterator begin() const { return firstFrom(first_); }
+    const_iterator end() const { return const_iterator{}; }
+
+    // One line per bucket in the directory, in list order: its first
+    // directory entry, local depth and keys, overflow buckets after a |
+    void dump(std::ostream& o = std::cerr) const {
+        o << "global depth " << globalDepth_ << ", " << buckets_ << " buckets\n";
+        for (const Bucket* bucket = first_; bucket; bucket = bucket->next) {
+            if (directory_[bucket->bits] != bucket) continue;
+            o << bucket->bits << " (" << bucket->localDepth << "):";
+            for (const Bucket* chain = bucket; chain; chain = chain->overflow) {
+                if (chain != bucket) o << " |";
+                for (size_t j = 0; j < N; ++j) {
+                    j < chain->count ? o << " " << chain->keys[j] : o << " -";
+                }
+            }
+            o << "\n";
+        }
+    }
+
+    friend bool operator==(const extendible_ads_set& lhs, const extendible_ads_set& rhs) {
+        if (lhs.size_ != rhs.size_) return false;
+        bool equal = true;
+        rhs.for_each([&lhs, &equal](const key_type& key) {
+            if (equal && !lhs.count(key)) equal = false;
+        });
+        return equal;
+    }
+    friend bool operator!=(const extendible_ads_set& lhs, const extendible_ads_set& rhs) { return !(lhs == rhs); }
+};
+
+// Position of a key: its bucket and the index there
+template<typename Key, size_t N, typename Directory>
+class extendible_ads_set<Key, N, Directory>::Iterator {
+private:
+    friend class extendible_ads_set<Key, N, Directory>;
+
+    const Bucket* bucket_{nullptr};
+    size_t index_{0};
+
+    Iterator(const Bucket* bucket, size_t index): bucket_{bucket}, index_{index} {}
+
+public:
+    using value_type = Key;
+    using difference_type = std::ptrdiff_t;
+    using reference = const value_type &;
+    using pointer = const value_type *;
+    using iterator_category = std::forward_iterator_tag;
+
+    Iterator() = default;
+
+    reference operator*() const {
+        if (!bucket_) throw std::runtime_error("Access beyond iterator");
+        return bucket_->keys[index_];
+    }
+    pointer operator->() const { return &bucket_->keys[index_]; }
+
+    Iterator& operator++() {
+        if (++index_ < bucket_->count) return *this;
+        *this = firstFrom(bucket_->next);
+        return *this;
+    }
+
+    Iterator operator++(int) {
+        Iterator other{*this};
+        ++*this;
+        return other;
+    }
+
+    friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+        return lhs.bucket_ == rhs.bucket_ && lhs.index_ == rhs.index_;
+    }
+    friend bool operator!=(const Iterator& lhs, const Iterator& rhs) { return !(lhs == rhs); }
+};
+
+template<typename Key, size_t N, typename Directory>
+void swap(extendible_ads_set<Key, N, Directory>& lhs, extendible_ads_set<Key, N, Directory>& rhs) { lhs.swap(rhs); }
+
+#endif // EXTENDIBLE_ADS_SET_H
@@ -0,0 +1,221 @@
+#ifndef FROZEN_ADS_SET_H
+#define FROZEN_ADS_SET_H
+
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ADS_set.h"
+
+// Read-only ADS_set view over a file mapped with mmap. The file is a flat
+// linear hashing directory: slot i holds the keys keys[offsets[i], offsets[i+1]),
+// so opening does no deserialization and all processes mapping the same file
+// share one copy in the page cache.
+//
+// Layout (native byte order): Header, tableSize + 1 uint64_t offsets, keys.
+template<typename Key>
+class frozen_ads_set {
+public:
+    using value_type = Key;
+    using key_type = Key;
+    using reference = const key_type &;
+    using const_reference = const key_type &;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using iterator = const key_type *;
+    using const_iterator = const key_type *;
+    using key_equal = std::equal_to<key_type>;
+    using hasher = std::hash<key_type>;
+
+    static_assert(std::is_trivially_copyable<Key>::value, "frozen_ads_set needs trivially copyable keys");
+    static_assert(alignof(Key) <= alignof(uint64_t), "frozen_ads_set keys must not need more than 8 byte alignment");
+
+private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t keySize;
+        uint32_t reserved;
+        uint64_t d;
+        uint64_t nextToSplit;
+        uint64_t tableSize;
+        uint64_t size;
+    };
+    static const uint32_t VERSION = 1;
+    // average keys per slot the writer aims for
+    static const size_t KEYS_PER_SLOT = 2;
+
+    void* base_{nullptr};
+    size_t length_{0};
+    const Header* header_{nullptr};
+    const uint64_t* offsets_{nullptr};
+    const Key* keys_{nullptr};
+
+    static size_t address(size_t hash, size_t d, size_t nextToSplit) {
+        size_t n = hash % (size_t(1) << d);
+        return n >= nextToSplit ? n : hash % (size_t(1) << (d + 1));
+    }
+
+    size_t bucketAddress(const Key& key) const {
+        return address(hasher{}(key), header_->d, header_->nextToSplit);
+    }
+
+    void unmap() {
+        if (base_) munmap(base_, length_);
+        base_ = nullptr;
+        length_ = 0;
+        header_ = nullptr;
+        offsets_ = nullptr;
+        keys_ = nullptr;
+    }
+
+    // Checks the header against the file length without overflowing, and
+    // that the offsets rise from 0 to size, so find() stays in the mapping
+    bool valid() const {
+        if (0 != std::memcmp(header_->magic, "ADSF", 4) || VERSION != header_->version
+                || sizeof(Key) != header_->keySize || header_->d >= 63
+                || header_->nextToSplit >= (uint64_t(1) << header_->d)
+                || header_->tableSize != (uint64_t(1) << header_->d) + header_->nextToSplit)
+            return false;
+        size_t words = (length_ - sizeof(Header)) / sizeof(uint64_t);
+        if (header_->tableSize >= words) return false;
+        size_t keyBytes = length_ - sizeof(Header) - (header_->tableSize + 1) * sizeof(uint64_t);
+        if (keyBytes % sizeof(Key) != 0 || keyBytes / sizeof(Key) != header_->size) return false;
+
+        if (offsets_[0] != 0 || offsets_[header_->tableSize] != header_->size) return false;
+        for (size_t i = 0; i < header_->tableSize; ++i) {
+            if (offsets_[i] > offsets_[i + 1]) return false;
+        }
+        return true;
+    }
+
+public:
+    frozen_ads_set() = default;
+
+    explicit frozen_ads_set(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("frozen_ads_set: cannot open " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+            ::close(fd);
+            throw std::runtime_error("frozen_ads_set: " + path + " is not a frozen set");
+        }
+        length_ = size_t(st.st_size);
+        base_ = mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (MAP_FAILED == base_) {
+            base_ = nullptr;
+            throw std::runtime_error("frozen_ads_set: cannot map " + path);
+        }
+
+        header_ = static_cast<const Header*>(base_);
+        offsets_ = reinterpret_cast<const uint64_t*>(header_ + 1);
+        if (!valid()) {
+            unmap();
+            throw std::runtime_error("frozen_ads_set: " + path + " is not a frozen set");
+        }
+        keys_ = reinterpret_cast<const Key*>(offsets_ + header_->tableSize + 1);
+    }
+
+    frozen_ads_set(const frozen_ads_set&) = delete;
+    frozen_ads_set& operator=(const frozen_ads_set&) = delete;
+
+    frozen_ads_set(frozen_ads_set&& other) noexcept { swap(other); }
+
+    frozen_ads_set& operator=(frozen_ads_set&& other) noexcept {
+        frozen_ads_set tmp{std::move(other)};
+        swap(tmp);
+        return *this;
+    }
+
+    ~frozen_ads_set() { unmap(); }
+
+    void swap(frozen_ads_set& other) noexcept {
+        std::swap(base_, other.base_);
+        std::swap(length_, other.length_);
+        std::swap(header_, other.header_);
+        std::swap(offsets_, other.offsets_);
+        std::swap(keys_, other.keys_);
+    }
+
+    // Writes the keys of set as a frozen file; the directory is sized for the
+    // key count, independent of the layout set itself uses. The file is
+    // written next to path and renamed over it, so views of the old file
+    // stay valid.
+    template<size_t N, typename Layout>
+    static void write(const std::string& path, const ADS_set<Key, N, Layout>& set) {
+        size_t tableSize = std::max<size_t>(4, set.size() / KEYS_PER_SLOT);
+        size_t d = 0;
+        while ((size_t(2) << d) <= tableSize) ++d;
+        Header header{{'A', 'D', 'S', 'F'}, VERSION, uint32_t(sizeof(Key)), 0,
+                      d, tableSize - (size_t(1) << d), tableSize, set.size()};
+
+        // counting sort of the keys by slot
+        std::vector<uint64_t> offsets(tableSize + 1, 0);
+        set.for_each([&](const Key& key) {
+            ++offsets[address(hasher{}(key), header.d, header.nextToSplit) + 1];
+        });
+        for (size_t i = 0; i < tableSize; ++i) {
+            offsets[i + 1] += offsets[i];
+        }
+        std::vector<Key> keys(set.size());
+        std::vector<uint64_t> next(offsets.begin(), offsets.end() - 1);
+        set.for_each([&](const Key& key) {
+            keys[next[address(hasher{}(key), header.d, header.nextToSplit)]++] = key;
+        });
+
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream o{tmp, std::ios::binary | std::ios::trunc};
+            o.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            o.write(reinterpret_cast<const char*>(offsets.data()), std::streamsize(offsets.size() * sizeof(uint64_t)));
+            o.write(reinterpret_cast<const char*>(keys.data()), std::streamsize(keys.size() * sizeof(Key)));
+            if (!o.flush()) throw std::runtime_error("frozen_ads_set: cannot write " + tmp);
+        }
+        int fd = ::open(tmp.c_str(), O_RDONLY);
+        if (fd < 0 || fsync(fd) != 0) {
+            if (fd >= 0) ::close(fd);
+            throw std::runtime_error("frozen_ads_set: cannot sync " + tmp);
+        }
+        ::close(fd);
+        if (std::rename(tmp.c_str(), path.c_str()) != 0)
+            throw std::runtime_error("frozen_ads_set: cannot replace " + path);
+    }
+
+    size_type size() const { return header_ ? header_->size : 0; }
+
+    bool empty() const { return !size(); }
+
+    size_type count(const key_type& key) const { return find(key) != end(); }
+
+    const_iterator find(const key_type& key) const {
+        if (empty()) return end();
+
+        size_t index = bucketAddress(key);
+        for (const Key* it = keys_ + offsets_[index], *last = keys_ + offsets_[index + 1]; it != last; ++it) {
+            if (key_equal{}(key, *it)) return it;
+        }
+        return end();
+    }
+
+    const_iterator begin() const { return keys_; }
+    const_iterator end() const { return keys_ + size(); }
+};
+
+template<typename Key>
+void swap(frozen_ads_set<Key>& lhs, frozen_ads_set<Key>& rhs) { lhs.swap(rhs); }
+
+#endif // FROZEN_ADS_SET_H
@@ -0,0 +1,135 @@
+// Test for frozen_ads_set.h
+//
+// Sets of several sizes, the empty one included, are written and opened
+// again and compared key by key. Files of another key size, truncated ones
+// and ones with corrupted header fields or offsets must make opening throw
+// std::runtime_error. A view stays valid while write() replaces its file.
+//
+// g++ -Wall -Wextra -O2 --std=c++14 frozentest.cpp -o frozentest && ./frozentest
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <string>
+
+#include "ADS_set.h"
+#include "frozen_ads_set.h"
+#include "testutil.h"
+
+const char* const PATH = "frozentest.set";
+
+using frozen_set = frozen_ads_set<unsigned>;
+
+std::string read_file(const std::string& path) {
+    std::ifstream i{path, std::ios::binary};
+    return std::string{std::istreambuf_iterator<char>(i), std::istreambuf_iterator<char>()};
+}
+
+void write_file(const std::string& path, const std::string& data) {
+    std::ofstream o{path, std::ios::binary | std::ios::trunc};
+    o.write(data.data(), std::streamsize(data.size()));
+}
+
+// keys [first, first + n)
+std::set<unsigned> write_keys(size_t first, size_t n) {
+    ADS_set<unsigned> set;
+    std::set<unsigned> expected;
+    for (size_t i = first; i < first + n; ++i) {
+        set.insert(make_key<unsigned>(i));
+        expected.insert(make_key<unsigned>(i));
+    }
+    frozen_set::write(PATH, set);
+    return expected;
+}
+
+int round_trip(size_t n) {
+    std::set<unsigned> expected = write_keys(0, n);
+    frozen_set frozen{PATH};
+    std::string what = std::to_string(n) + " keys: ";
+    if (!same(frozen, expected)) return fail(what + "contents differ");
+    if (frozen.empty() != expected.empty()) return fail(what + "empty()");
+    for (size_t i = n; i < n + 100; ++i) {
+        if (frozen.count(make_key<unsigned>(i)) || frozen.find(make_key<unsigned>(i)) != frozen.end())
+            return fail(what + "found a key that is not there");
+    }
+    return 0;
+}
+
+int rejects(const std::string& data, const std::string& what) {
+    write_file(PATH, data);
+    try {
+        frozen_set frozen{PATH};
+    } catch (const std::runtime_error&) {
+        return 0;
+    }
+    return fail(what + ": opened");
+}
+
+// Header: magic, version, key size, reserved (4 bytes each), then d,
+// nextToSplit, tableSize and size (8 bytes each), then the offsets
+int corruption() {
+    int errors = 0;
+    write_keys(0, 1000);
+    std::string data = read_file(PATH);
+
+    auto patched = [&](size_t offset, uint64_t value) {
+        std::string corrupt = data;
+        std::memcpy(&corrupt[offset], &value, sizeof(value));
+        return corrupt;
+    };
+    uint64_t tableSize;
+    std::memcpy(&tableSize, &data[32], 8);
+    size_t offsets = 48;
+
+    errors += rejects(data.substr(0, 20), "shorter than the header");
+    errors += rejects(data.substr(0, data.size() - 1), "truncated");
+    errors += rejects(data + std::string(4, '\0'), "trailing bytes");
+    errors += rejects(patched(0, 'X'), "magic");
+    // a tableSize and a size whose byte counts overflow
+    errors += rejects(patched(16, 62), "d of 62 and the offsets of 2^62 slots");
+    errors += rejects(patched(40, uint64_t(1) << 62), "size of 2^62 keys");
+    errors += rejects(patched(40, 999), "size one short");
+    errors += rejects(patched(offsets, 5), "first offset not 0");
+    errors += rejects(patched(offsets + 8 * tableSize, 999), "last offset not the size");
+    // a slot range that runs backwards or beyond the keys
+    errors += rejects(patched(offsets + 8 * (tableSize / 2), 0), "decreasing offsets");
+    errors += rejects(patched(offsets + 8 * (tableSize / 2), uint64_t(1) << 40), "offset beyond the keys");
+    return errors;
+}
+
+int main() {
+    int errors = 0;
+
+    for (size_t n: {0, 1, 2, 3, 1000, 100000}) {
+        errors += round_trip(n);
+    }
+    frozen_set none;
+    if (!none.empty() || none.begin() != none.end() || none.count(1)) errors += fail("default constructed set");
+
+    // a file of 8 byte keys is not one of 4 byte keys
+    {
+        ADS_set<uint64_t> wide{1, 2, 3};
+        frozen_ads_set<uint64_t>::write(PATH, wide);
+        errors += rejects(read_file(PATH), "another key size");
+    }
+    errors += corruption();
+
+    // write() replaces the file, a view of the old one keeps its keys
+    {
+        std::set<unsigned> first = write_keys(0, 50000);
+        frozen_set old{PATH};
+        std::set<unsigned> second = write_keys(1000000, 20000);
+        if (!same(old, first)) errors += fail("view changed by rewriting its file");
+        frozen_set current{PATH};
+        if (!same(current, second)) errors += fail("rewritten file");
+    }
+
+    std::remove(PATH);
+    if (errors) return 1;
+    std::cout << "OK\n";
+    return 0;
+}
@@ -8,17 +8,23 @@
 #endif
 
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <future>
 #include <iostream>
+#include <numeric>
 #include <random>
 #include <set>
 #include <sstream>
+#include <string>
 #include <thread>
 #include <vector>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/wait.h>
 
 // VG MACROS {{{
 // entnommen aus valgrind/valgrind.h zwecks vermeidung von dependency darauf.
@@ -56,6 +62,12 @@
 // }}}
 
 #include "ADS_set.h"
+#include "frozen_ads_set.h"
+#include "disk_ads_set.h"
+#include "wal_ads_set.h"
+#include "maintained_ads_set.h"
+#include "extendible_ads_set.h"
+#include "testutil.h"
 
 #define PH2
 
@@ -1504,10 +1516,1024 @@ void do_the_thing(size_t n) {
     return;
 }
 
+template <typename F>
+double elapsed_ms(F&& f) {
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void bench_copy(size_t n) {
+    std::vector<size_t> vs(n);
+    std::iota(vs.begin(), vs.end(), 0);
+    ADS_set<size_t> a(vs.begin(), vs.end());
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // the copies outlive the timed parts, so checking and destroying them is not timed
+    ADS_set<size_t> reinserted, cloned, parallel;
+    double elapsed_reinsert = elapsed_ms([&] {
+        reinserted.insert(a.begin(), a.end());
+    });
+    double elapsed_clone = elapsed_ms([&] {
+        cloned = a;
+    });
+    double elapsed_parallel = elapsed_ms([&] {
+        ADS_set<size_t> b{a, threads};
+        parallel.swap(b);
+    });
+    if(reinserted != a || cloned != a || parallel != a) std::abort();
+
+    std::cerr << "copy (n = " << n << "): reinsert = " << elapsed_reinsert << " ms, clone = " << elapsed_clone
+              << " ms, clone with " << threads << " threads = " << elapsed_parallel << " ms\n";
+}
+
+void bench_equal(size_t n) {
+    std::vector<size_t> vs(n);
+    std::iota(vs.begin(), vs.end(), 0);
+    ADS_set<size_t> a(vs.begin(), vs.end());
+    ADS_set<size_t> b{a};
+    // same keys, but grown further before erasing the extra ones: layouts differ
+    ADS_set<size_t> c(vs.begin(), vs.end());
+    for(size_t i = n; i < n + n / 2; ++i) c.insert(i);
+    for(size_t i = n; i < n + n / 2; ++i) c.erase(i);
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+    auto probe = [&](ADS_set<size_t> const& x, ADS_set<size_t> const& y) {
+        if(x.size() != y.size()) return false;
+        for(auto const& v: y) {
+            if(x.find(v) == x.end()) return false;
+        }
+        return true;
+    };
+
+    bool r1 = false, r2 = false, r3 = false, r4 = false;
+    double elapsed_probe = elapsed_ms([&] { r1 = probe(a, b); });
+    double elapsed_slots = elapsed_ms([&] { r2 = a == b; });
+    double elapsed_parallel = elapsed_ms([&] { r3 = a.equals(b, threads); });
+    double elapsed_mismatch = elapsed_ms([&] { r4 = a == c; });
+    if(!r1 || !r2 || !r3 || !r4) std::abort();
+
+    std::cerr << "equal (n = " << n << "): probing = " << elapsed_probe << " ms, slotwise = " << elapsed_slots
+              << " ms, slotwise with " << threads << " threads = " << elapsed_parallel
+              << " ms, different layouts = " << elapsed_mismatch << " ms\n";
+}
+
+void bench_iterate(size_t n) {
+    RNG gen{42};
+    std::vector<size_t> vs(n);
+    for(auto& v: vs) v = gen();
+    ADS_set<size_t> a(vs.begin(), vs.end());
+
+    size_t sum = 0, found = 0;
+    double elapsed_iter = elapsed_ms([&] {
+        for(int round = 0; round < 10; ++round) {
+            for(auto const& v: a) sum += v;
+        }
+    });
+    double elapsed_find = elapsed_ms([&] {
+        for(auto const& v: vs) found += a.find(v) != a.end();
+    });
+    if(found != a.size()) std::abort();
+
+    std::cerr << "iterate (n = " << n << ", sizeof(iterator) = " << sizeof(ADS_set<size_t>::iterator) << "): "
+              << 10 * n / elapsed_iter / 1000 << " M keys/s, find = " << elapsed_find << " ms (checksum " << sum % 1000 << ")\n";
+}
+
+void bench_for_each(size_t n) {
+    RNG gen{42};
+    std::vector<size_t> vs(n);
+    for(auto& v: vs) v = gen() % (n * 4);
+    ADS_set<size_t> a(vs.begin(), vs.end());
+
+    size_t sum_iter = 0, sum_each = 0, sum_bucket = 0;
+    double elapsed_iter = elapsed_ms([&] {
+        for(auto const& v: a) sum_iter += v;
+    });
+    double elapsed_each = elapsed_ms([&] {
+        a.for_each([&](size_t v) { sum_each += v; });
+    });
+    double elapsed_bucket = elapsed_ms([&] {
+        a.for_each_bucket([&](size_t const* keys, size_t k) {
+            size_t s = 0;
+            for(size_t i = 0; i < k; ++i) s += keys[i];
+            sum_bucket += s;
+        });
+    });
+    if(sum_iter != sum_each || sum_iter != sum_bucket) std::abort();
+
+    std::cerr << "for_each (n = " << a.size() << "): begin()/end() = " << elapsed_iter << " ms, for_each = "
+              << elapsed_each << " ms, for_each_bucket = " << elapsed_bucket << " ms\n";
+}
+
+void bench_sparse(size_t n) {
+    std::vector<size_t> vs(n);
+    std::iota(vs.begin(), vs.end(), 0);
+    ADS_set<size_t> a(vs.begin(), vs.end());
+    // keep 1 % of the keys; the directory does not shrink
+    for(auto const& v: vs) {
+        if(v % 100 != 99) a.erase(v);
+    }
+
+    size_t count = 0;
+    double elapsed_begin = elapsed_ms([&] {
+        for(int round = 0; round < 100; ++round) count += a.begin() != a.end();
+    });
+    double elapsed_iter = elapsed_ms([&] {
+        for(auto it = a.begin(); it != a.end(); ++it) ++count;
+    });
+    if(count != 100 + a.size()) std::abort();
+
+    std::cerr << "sparse (n = " << n << ", live = " << a.size() << "): 100x begin() = " << elapsed_begin
+              << " ms, full iteration = " << elapsed_iter << " ms\n";
+}
+
+void bench_snapshot(size_t n) {
+    char const* path = "ads_set.snapshot";
+    RNG gen{42};
+    std::vector<unsigned> vs(n);
+    for(auto& v: vs) v = unsigned(gen());
+
+    double elapsed_build, elapsed_save, elapsed_load;
+    size_t size;
+    {
+        ADS_set<unsigned> a;
+        elapsed_build = elapsed_ms([&] { a.insert(vs.begin(), vs.end()); });
+        size = a.size();
+        elapsed_save = elapsed_ms([&] {
+            std::ofstream o{path, std::ios::binary};
+            a.save(o);
+        });
+    }
+    {
+        ADS_set<unsigned> a;
+        elapsed_load = elapsed_ms([&] {
+            std::ifstream i{path, std::ios::binary};
+            a.load(i);
+        });
+        if(a.size() != size || !a.count(vs.front()) || !a.count(vs.back())) std::abort();
+    }
+    std::remove(path);
+
+    std::cerr << "snapshot (n = " << n << "): build by insert = " << elapsed_build << " ms, save = " << elapsed_save
+              << " ms, load = " << elapsed_load << " ms\n";
+}
+
+void bench_frozen(size_t n) {
+    char const* snapshot = "ads_set.snapshot";
+    char const* frozen = "ads_set.frozen";
+    RNG gen{42};
+    std::vector<unsigned> vs(n);
+    for(auto& v: vs) v = unsigned(gen());
+    {
+        ADS_set<unsigned> a(vs.begin(), vs.end());
+        std::ofstream o{snapshot, std::ios::binary};
+        a.save(o);
+        frozen_ads_set<unsigned>::write(frozen, a);
+    }
+
+    size_t found_loaded = 0, found_frozen = 0;
+    double elapsed_load, elapsed_open, elapsed_count_loaded, elapsed_count_frozen;
+    {
+        ADS_set<unsigned> a;
+        elapsed_load = elapsed_ms([&] {
+            std::ifstream i{snapshot, std::ios::binary};
+            a.load(i);
+        });
+        elapsed_count_loaded = elapsed_ms([&] {
+            for(auto const& v: vs) found_loaded += a.count(v);
+        });
+    }
+    {
+        frozen_ads_set<unsigned> f;
+        elapsed_open = elapsed_ms([&] { f = frozen_ads_set<unsigned>{frozen}; });
+        elapsed_count_frozen = elapsed_ms([&] {
+            for(auto const& v: vs) found_frozen += f.count(v);
+        });
+        if(found_frozen != found_loaded || size_t(std::distance(f.begin(), f.end())) != f.size()) std::abort();
+    }
+    std::remove(snapshot);
+    std::remove(frozen);
+
+    std::cerr << "frozen (n = " << n << "): load() = " << elapsed_load << " ms, mmap open = " << elapsed_open
+              << " ms, count on loaded set = " << elapsed_count_loaded << " ms, count on frozen set = "
+              << elapsed_count_frozen << " ms\n";
+}
+
+void bench_disk(size_t n) {
+    char const* path = "ads_set.pages";
+    RNG gen{42};
+    std::vector<unsigned> vs(n);
+    for(auto& v: vs) v = unsigned(gen());
+
+    for(size_t pool: {64, 1024, 16384}) {
+        std::remove(path);
+        std::remove((std::string{path} + ".overflow").c_str());
+        disk_ads_set<unsigned> d{path, pool};
+
+        double elapsed_insert = elapsed_ms([&] {
+            for(auto const& v: vs) d.insert(v);
+        });
+        auto inserted = d.stats();
+        d.reset_stats();
+
+        size_t found = 0;
+        double elapsed_count = elapsed_ms([&] {
+            for(size_t i = 0; i < n; ++i) found += d.count(i % 2 ? vs[i] : unsigned(gen()));
+        });
+        auto counted = d.stats();
+        if(found < n / 2) std::abort();
+
+        std::cerr << "disk (n = " << n << ", pool = " << pool << " of " << d.file_pages() << " pages): insert "
+                  << n / elapsed_insert << " k ops/s, " << double(inserted.reads) / n << " reads/op, "
+                  << double(inserted.writes) / n << " writes/op; count " << n / elapsed_count << " k ops/s, "
+                  << double(counted.reads) / n << " reads/op\n";
+    }
+    std::remove(path);
+    std::remove((std::string{path} + ".overflow").c_str());
+}
+
+void bench_wal(size_t n) {
+    std::string path = "ads_set.wal_bench";
+    auto remove_files = [&] {
+        std::remove((path + ".wal").c_str());
+        std::remove((path + ".snapshot").c_str());
+    };
+
+    for(size_t group: {1, 8, 64, 512, 4096}) {
+        remove_files();
+        double elapsed_insert, elapsed_recover;
+        {
+            wal_ads_set<unsigned> w{path, group};
+            elapsed_insert = elapsed_ms([&] {
+                for(size_t i = 0; i < n; ++i) w.insert(unsigned(i * 2654435761u));
+                w.commit();
+            });
+        }
+        size_t recovered = 0;
+        elapsed_recover = elapsed_ms([&] {
+            wal_ads_set<unsigned> w{path, group};
+            recovered = w.size();
+        });
+        if(recovered != n) std::abort();
+
+        std::cerr << "wal (n = " << n << ", group commit = " << group << "): insert " << n / elapsed_insert
+                  << " k ops/s, replay " << elapsed_recover << " ms\n";
+    }
+    remove_files();
+}
+
+struct Person {
+    std::string first, last;
+};
+
+bool operator==(Person const& lhs, Person const& rhs) { return lhs.first == rhs.first && lhs.last == rhs.last; }
+bool operator<(Person const& lhs, Person const& rhs) {
+    return lhs.last < rhs.last || (lhs.last == rhs.last && lhs.first < rhs.first);
+}
+
+namespace std {
+    template <>
+    struct hash<Person> {
+        size_t operator()(Person const& p) const {
+            return std::hash<std::string>{}(p.first) ^ std::hash<std::string>{}(p.last) << 1;
+        }
+    };
+}
+
+template <> Person make_key<Person>(size_t v) { return Person{"first" + std::to_string(v), "last" + std::to_string(v / 7)}; }
+
+template <typename Set>
+void bench_layout_one(char const* name, std::vector<typename Set::key_type> const& keys) {
+    Set a;
+    double elapsed_insert = elapsed_ms([&] {
+        for(auto const& k: keys) a.insert(k);
+    });
+    size_t found = 0;
+    double elapsed_count = elapsed_ms([&] {
+        for(auto const& k: keys) found += a.count(k);
+    });
+    double elapsed_iter = elapsed_ms([&] {
+        for(auto it = a.begin(); it != a.end(); ++it) ++found;
+    });
+    if(found != 2 * keys.size()) std::abort();
+
+    std::cerr << "  " << name << ": insert = " << elapsed_insert << " ms, count = " << elapsed_count
+              << " ms, iterate = " << elapsed_iter << " ms\n";
+}
+
+template <typename Key>
+void bench_layout_type(char const* type, size_t n) {
+    RNG gen{42};
+    std::vector<Key> keys;
+    for(size_t i = 0; i < n; ++i) keys.push_back(make_key<Key>(gen()));
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::shuffle(keys.begin(), keys.end(), gen);
+
+    std::cerr << "layout " << type << " (n = " << keys.size() << ", sizeof = " << sizeof(Key) << ")\n";
+    bench_layout_one<ADS_set<Key>>("default N=3          ", keys);
+    bench_layout_one<ADS_fit_set<Key, 64>>(("fit 64B,   N=" + std::to_string(ADS_fit<Key, 64>::value) + "   ").c_str(), keys);
+    bench_layout_one<ADS_fit_set<Key, 128>>(("fit 128B,  N=" + std::to_string(ADS_fit<Key, 128>::value) + "   ").c_str(), keys);
+    bench_layout_one<ADS_fit_set<Key, 4096>>(("fit 4096B, N=" + std::to_string(ADS_fit<Key, 4096>::value) + " ").c_str(), keys);
+}
+
+void bench_layout(size_t n) {
+    bench_layout_type<unsigned>("unsigned", n);
+    bench_layout_type<std::string>("std::string", n);
+    bench_layout_type<Person>("Person", n);
+}
+
+// resident set size in bytes
+size_t resident_bytes() {
+    std::ifstream statm{"/proc/self/statm"};
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * size_t(sysconf(_SC_PAGESIZE));
+}
+
+// runs f in a child process, so memory freed by earlier runs does not skew RSS deltas
+template <typename F>
+void in_child(F&& f) {
+    std::cerr.flush();
+    pid_t pid = fork();
+    if(pid < 0) std::abort();
+    if(pid > 0) {
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+    f();
+    _exit(0);
+}
+
+template <typename Set>
+void bench_compact_one(char const* name, size_t n) {
+    in_child([&] {
+        size_t before = resident_bytes();
+        size_t found = 0;
+        double elapsed_insert, elapsed_count;
+        size_t bytes;
+        {
+            Set a;
+            // odd multiplier: distinct keys for n < 2^32
+            elapsed_insert = elapsed_ms([&] {
+                for(size_t i = 0; i < n; ++i) a.insert(unsigned(i * 2654435761u));
+            });
+            elapsed_count = elapsed_ms([&] {
+                for(size_t i = 0; i < n; ++i) found += a.count(unsigned(i * 2654435761u));
+            });
+            bytes = resident_bytes() - before;
+        }
+        if(found != n) std::abort();
+
+        std::cerr << "  " << name << ": " << double(bytes) / double(n) << " bytes/key, insert = " << elapsed_insert
+                  << " ms, count = " << elapsed_count << " ms\n";
+    });
+}
+
+void bench_compact(size_t n) {
+    std::cerr << "compact (n = " << n << ", unsigned, payload " << sizeof(unsigned) << " bytes/key)\n";
+    bench_compact_one<ADS_set<unsigned, 3, ADS_compact_layout>>("compact N=3 ", n);
+    bench_compact_one<ADS_set<unsigned, 3>>("default N=3 ", n);
+    bench_compact_one<ADS_set<unsigned, ADS_fit<unsigned, 64, true>::value, ADS_fit_layout<64, true>>>("compact 64B ", n);
+}
+
+template <typename Set>
+void bench_strings_one(char const* name, std::vector<std::string> const& keys) {
+    in_child([&] {
+        size_t before = resident_bytes();
+        Set a;
+        double elapsed_insert = elapsed_ms([&] {
+            for(auto const& k: keys) a.insert(k);
+        });
+        size_t bytes = resident_bytes() - before;
+        size_t found = 0;
+        double elapsed_count = elapsed_ms([&] {
+            for(auto const& k: keys) found += a.count(k);
+        });
+        double elapsed_copy = elapsed_ms([&] {
+            Set b{a};
+            found += b.size();
+        });
+        double elapsed_erase = elapsed_ms([&] {
+            for(auto const& k: keys) found += a.erase(k);
+        });
+        if(found != 3 * keys.size()) std::abort();
+
+        std::cerr << "  " << name << ": " << double(bytes) / double(keys.size()) << " bytes/key, insert = "
+                  << elapsed_insert << " ms, count = " << elapsed_count << " ms, copy = " << elapsed_copy
+                  << " ms, erase = " << elapsed_erase << " ms\n";
+    });
+}
+
+void bench_strings(size_t n) {
+    for(size_t length: {8, 40}) {
+        std::vector<std::string> keys;
+        for(size_t i = 0; i < n; ++i) {
+            std::string key = std::to_string(i);
+            key.resize(length, '#');
+            keys.push_back(key);
+        }
+        std::cerr << "strings (n = " << n << ", length " << length << ")\n";
+        bench_strings_one<ADS_set<std::string>>("default N=3  ", keys);
+        bench_strings_one<ADS_set<std::string, 3, ADS_compact_layout>>("compact N=3  ", keys);
+        bench_strings_one<ADS_set<std::string, 16>>("default N=16 ", keys);
+    }
+}
+
+template <typename Set>
+void bench_trivial_one(char const* name, std::vector<typename Set::key_type> const& keys) {
+    Set a;
+    double elapsed_insert = elapsed_ms([&] {
+        for(auto const& k: keys) a.insert(k);
+    });
+    size_t found = 0;
+    double elapsed_copy = elapsed_ms([&] {
+        Set b{a};
+        found += b.size();
+    });
+    // every other key, so erase shifts keys within the buckets
+    double elapsed_erase = elapsed_ms([&] {
+        for(size_t i = 0; i < keys.size(); i += 2) found += a.erase(keys[i]);
+    });
+    if(found != keys.size() + (keys.size() + 1) / 2) std::abort();
+
+    std::cerr << "  " << name << ": insert = " << elapsed_insert << " ms, copy = " << elapsed_copy
+              << " ms, erase = " << elapsed_erase << " ms\n";
+}
+
+void bench_trivial(size_t n) {
+    std::vector<unsigned> keys(n);
+    std::iota(keys.begin(), keys.end(), 0u);
+    std::shuffle(keys.begin(), keys.end(), RNG{7});
+
+    std::cerr << "trivial (n = " << n << ", unsigned)\n";
+    bench_trivial_one<ADS_set<unsigned, 3>>("N=3    ", keys);
+    bench_trivial_one<ADS_set<unsigned, 16>>("N=16   ", keys);
+    bench_trivial_one<ADS_fit_set<unsigned, 256>>("N=60   ", keys);
+    bench_trivial_one<ADS_fit_set<unsigned, 4096>>("N=1020 ", keys);
+}
+
+template <typename Set>
+void bench_sorted_one(char const* name, std::vector<unsigned> const& keys, std::vector<unsigned> const& misses) {
+    Set a;
+    double elapsed_insert = elapsed_ms([&] {
+        for(auto k: keys) a.insert(k);
+    });
+    size_t found = 0;
+    double elapsed_hit = elapsed_ms([&] {
+        for(auto k: keys) found += a.count(k);
+    });
+    double elapsed_miss = elapsed_ms([&] {
+        for(auto k: misses) found += a.count(k);
+    });
+    double elapsed_erase = elapsed_ms([&] {
+        for(auto k: keys) found += a.erase(k);
+    });
+    if(found != 2 * keys.size()) std::abort();
+
+    std::cerr << "  " << name << ": insert = " << elapsed_insert << " ms, hit = " << elapsed_hit
+              << " ms, miss = " << elapsed_miss << " ms, erase = " << elapsed_erase << " ms\n";
+}
+
+template <size_t Size>
+void bench_sorted_size(std::vector<unsigned> const& keys, std::vector<unsigned> const& misses) {
+    std::string name = "N=" + std::to_string(Size);
+    name.resize(7, ' ');
+    bench_sorted_one<ADS_set<unsigned, Size>>((name + " linear").c_str(), keys, misses);
+    bench_sorted_one<ADS_set<unsigned, Size, ADS_sorted_layout<>>>((name + " sorted").c_str(), keys, misses);
+}
+
+void bench_sorted(size_t n) {
+    // odd multiplier: all 2n keys are distinct and spread over all slots
+    std::vector<unsigned> keys(n), misses(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = unsigned(i * 2654435761u);
+        misses[i] = unsigned((n + i) * 2654435761u);
+    }
+    std::shuffle(keys.begin(), keys.end(), RNG{7});
+    std::shuffle(misses.begin(), misses.end(), RNG{8});
+
+    std::cerr << "sorted (n = " << n << ", unsigned)\n";
+    bench_sorted_size<4>(keys, misses);
+    bench_sorted_size<8>(keys, misses);
+    bench_sorted_size<16>(keys, misses);
+    bench_sorted_size<32>(keys, misses);
+    bench_sorted_size<64>(keys, misses);
+    bench_sorted_size<256>(keys, misses);
+    bench_sorted_size<1024>(keys, misses);
+}
+
+template <typename Set>
+void bench_filter_one(char const* name, std::vector<unsigned> const& keys, std::vector<unsigned> const& queries) {
+    Set a;
+    double elapsed_insert = elapsed_ms([&] {
+        for(auto k: keys) a.insert(k);
+    });
+    size_t found = 0;
+    double elapsed_query = elapsed_ms([&] {
+        for(auto k: queries) found += a.count(k);
+    });
+    // erased keys leave stale filter bits until compact()
+    for(size_t i = 0; i < keys.size(); i += 2) a.erase(keys[i]);
+    double elapsed_stale = elapsed_ms([&] {
+        for(auto k: queries) found += a.count(k);
+    });
+    double elapsed_compact = elapsed_ms([&] { a.compact(); });
+    double elapsed_compacted = elapsed_ms([&] {
+        for(auto k: queries) found += a.count(k);
+    });
+
+    std::cerr << "  " << name << ": insert = " << elapsed_insert << " ms, query = " << elapsed_query
+              << " ms, after erase = " << elapsed_stale << " ms, compact = " << elapsed_compact
+              << " ms, after compact = " << elapsed_compacted << " ms (" << found << ")\n";
+}
+
+void bench_filter(size_t n) {
+    // 10% of the queries hit
+    std::vector<unsigned> keys(n), queries(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = unsigned(i * 2654435761u);
+        queries[i] = unsigned((i % 10 ? n + i : i) * 2654435761u);
+    }
+    std::shuffle(keys.begin(), keys.end(), RNG{7});
+    std::shuffle(queries.begin(), queries.end(), RNG{8});
+
+    std::cerr << "filter (n = " << n << ", unsigned, 90% misses)\n";
+    bench_filter_one<ADS_set<unsigned, 3>>("N=3              ", keys, queries);
+    bench_filter_one<ADS_set<unsigned, 3, ADS_filter_layout<>>>("N=3 filter       ", keys, queries);
+    bench_filter_one<ADS_set<unsigned, 16>>("N=16             ", keys, queries);
+    bench_filter_one<ADS_set<unsigned, 16, ADS_filter_layout<>>>("N=16 filter      ", keys, queries);
+    bench_filter_one<ADS_fit_set<unsigned, 4096>>("fit 4096         ", keys, queries);
+    bench_filter_one<ADS_set<unsigned, ADS_fit<unsigned, 4096>::value, ADS_filter_layout<ADS_fit_layout<4096>>>>(
+            "fit 4096 filter  ", keys, queries);
+}
+
+void bench_algebra(size_t n) {
+    // b overlaps the second half of a, both have n keys and so the same directory
+    using Set = ADS_set<unsigned>;
+    Set a, b;
+    for(size_t i = 0; i < n; ++i) {
+        a.insert(unsigned(i * 2654435761u));
+        b.insert(unsigned((i + n / 2) * 2654435761u));
+    }
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::cerr << "algebra (n = " << n << ", unsigned, overlap n/2, " << threads << " threads)\n";
+
+    size_t sizes = 0;
+    double elapsed_probe_union = elapsed_ms([&] {
+        Set c{a};
+        b.for_each([&](unsigned k) { c.insert(k); });
+        sizes += c.size();
+    });
+    double elapsed_probe_intersection = elapsed_ms([&] {
+        Set c;
+        a.for_each([&](unsigned k) { if(b.count(k)) c.insert(k); });
+        sizes += c.size();
+    });
+    double elapsed_probe_difference = elapsed_ms([&] {
+        Set c;
+        a.for_each([&](unsigned k) { if(!b.count(k)) c.insert(k); });
+        sizes += c.size();
+    });
+    std::cerr << "  probing:       union = " << elapsed_probe_union << " ms, intersection = "
+              << elapsed_probe_intersection << " ms, difference = " << elapsed_probe_difference << " ms\n";
+
+    for(size_t t: {size_t{1}, threads}) {
+        double elapsed_union = elapsed_ms([&] { sizes -= set_union(a, b, t).size(); });
+        double elapsed_intersection = elapsed_ms([&] { sizes -= set_intersection(a, b, t).size(); });
+        double elapsed_difference = elapsed_ms([&] { sizes -= set_difference(a, b, t).size(); });
+        std::cerr << "  slotwise (" << t << "): union = " << elapsed_union << " ms, intersection = "
+                  << elapsed_intersection << " ms, difference = " << elapsed_difference << " ms\n";
+        if(sizes) std::abort();
+        sizes += n + n / 2 + n / 2 + n - n / 2;
+    }
+}
+
+// default layout without inline buckets: every set allocates its directory
+struct heap_layout: ADS_default_layout {
+    static const size_t inlineBytes = 0;
+};
+
+template <typename Set>
+void bench_small_one(char const* name, size_t n) {
+    // n sets of 0..7 keys, one after the other
+    size_t found = 0;
+    double elapsed_sets = elapsed_ms([&] {
+        for(size_t i = 0; i < n; ++i) {
+            Set a;
+            for(unsigned k = 0; k < i % 8; ++k) a.insert(unsigned(i + k));
+            found += a.count(unsigned(i)) + a.count(unsigned(i + 8));
+        }
+    });
+    // n empty sets alive at the same time
+    double elapsed_empty = elapsed_ms([&] {
+        std::vector<Set> sets(n);
+        found += sets.size();
+    });
+    Set a;
+    double elapsed_clear = elapsed_ms([&] {
+        for(size_t i = 0; i < n; ++i) {
+            a.insert(unsigned(i));
+            a.insert(unsigned(i + 1));
+            a.clear();
+        }
+    });
+    if(found != n - n / 8 + n) std::abort();
+
+    std::cerr << "  " << name << ": " << sizeof(Set) << " bytes/set, small sets = " << elapsed_sets
+              << " ms, empty sets = " << elapsed_empty << " ms, insert/clear = " << elapsed_clear << " ms\n";
+}
+
+void bench_small(size_t n) {
+    std::cerr << "small (n = " << n << " sets, 0..7 keys, unsigned)\n";
+    bench_small_one<ADS_set<unsigned, 7>>("inline N=7", n);
+    bench_small_one<ADS_set<unsigned, 7, heap_layout>>("heap N=7  ", n);
+    bench_small_one<ADS_set<unsigned, 3>>("inline N=3", n);
+    bench_small_one<ADS_set<unsigned, 3, heap_layout>>("heap N=3  ", n);
+}
+
+template <typename Set>
+void bench_clear_one(char const* name, size_t n, size_t cycles) {
+    Set a;
+    size_t found = 0;
+    double elapsed_keep = elapsed_ms([&] {
+        for(size_t c = 0; c < cycles; ++c) {
+            for(size_t i = 0; i < n; ++i) a.insert(unsigned((i + c) * 2654435761u));
+            found += a.size();
+            a.clear();
+        }
+    });
+    double elapsed_shrink = elapsed_ms([&] {
+        for(size_t c = 0; c < cycles; ++c) {
+            for(size_t i = 0; i < n; ++i) a.insert(unsigned((i + c) * 2654435761u));
+            found += a.size();
+            a.clear_and_shrink();
+        }
+    });
+    if(found != 2 * n * cycles) std::abort();
+
+    std::cerr << "  " << name << ": clear() = " << elapsed_keep << " ms, clear_and_shrink() = " << elapsed_shrink
+              << " ms\n";
+}
+
+void bench_clear(size_t n) {
+    // the same total number of inserts for every batch size
+    for(size_t batch: {size_t{100}, size_t{10000}, n}) {
+        size_t cycles = std::max<size_t>(1, n * 10 / batch);
+        std::cerr << "clear (fill " << batch << " keys, clear, " << cycles << " cycles, unsigned)\n";
+        bench_clear_one<ADS_set<unsigned, 3>>("N=3        ", batch, cycles);
+        bench_clear_one<ADS_set<unsigned, 3, ADS_compact_layout>>("compact N=3", batch, cycles);
+        bench_clear_one<ADS_set<unsigned, 16>>("N=16       ", batch, cycles);
+    }
+}
+
+template <typename Set>
+void bench_latency_one(char const* name, size_t n) {
+    // histogram of insert latencies by powers of two nanoseconds
+    std::vector<size_t> histogram(64, 0);
+    std::vector<uint32_t> latencies(n);
+    // inserts whose split starts a round, with the bucket count a power of two
+    uint32_t round_start = 0;
+    Set a;
+    for(size_t i = 0; i < n; ++i) {
+        size_t buckets = a.bucket_count();
+        auto start = std::chrono::steady_clock::now();
+        a.insert(unsigned(i * 2654435761u));
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        latencies[i] = uint32_t(std::min<long long>(ns, 0xffffffff));
+        if(a.bucket_count() != buckets && !(buckets & (buckets - 1))) round_start = std::max(round_start, latencies[i]);
+        ++histogram[63 - __builtin_clzll(uint64_t(ns) | 1)];
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[size_t(p * double(n - 1))]; };
+
+    std::cerr << "  " << name << ": p50 = " << percentile(0.5) << " ns, p99 = " << percentile(0.99)
+              << " ns, p99.99 = " << percentile(0.9999) << " ns, max = " << latencies.back() / 1000
+              << " us, max at a round start = " << round_start / 1000 << " us\n   ";
+    for(size_t b = 0; b < histogram.size(); ++b) {
+        if(histogram[b]) std::cerr << " <" << (uint64_t(2) << b) << "ns:" << histogram[b];
+    }
+    std::cerr << "\n";
+}
+
+void bench_latency(size_t n) {
+    std::cerr << "latency (n = " << n << " inserts, unsigned)\n";
+    bench_latency_one<ADS_set<unsigned, 3>>("N=3 doubling    ", n);
+    bench_latency_one<ADS_set<unsigned, 3, ADS_deamortized_layout<>>>("N=3 deamortized ", n);
+    bench_latency_one<ADS_set<unsigned, 16>>("N=16 doubling   ", n);
+    bench_latency_one<ADS_set<unsigned, 16, ADS_deamortized_layout<>>>("N=16 deamortized", n);
+}
+
+// Batches of 1000 timed inserts and 1000 lookups, each followed by 100 us
+// of idle time, in which idle(deadline) runs.
+template <typename Set, typename Idle>
+void bench_maintain_one(char const* name, Set& a, size_t n, Idle idle) {
+    std::vector<uint32_t> latencies;
+    latencies.reserve(n);
+    size_t found = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < n;) {
+        for(size_t end = std::min(n, i + 1000); i < end; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            a.insert(unsigned(i * 2654435761u));
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            latencies.push_back(uint32_t(std::min<long long>(ns, 0xffffffff)));
+            found += a.count(unsigned((i / 2) * 2654435761u));
+        }
+        idle(std::chrono::steady_clock::now() + std::chrono::microseconds{100});
+    }
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    if(found != n) std::abort();
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[size_t(p * double(n - 1))]; };
+    std::cerr << "  " << name << ": p50 = " << percentile(0.5) << " ns, p99 = " << percentile(0.99) << " ns, p99.9 = "
+              << percentile(0.999) << " ns, p99.99 = " << percentile(0.9999) << " ns, max = " << latencies.back() / 1000
+              << " us, total = " << elapsed << " ms, buckets = " << a.bucket_count() << "\n";
+}
+
+void bench_maintain(size_t n) {
+    std::cerr << "maintain (n = " << n << " inserts, unsigned, N=3, 100 us idle per 1000 inserts)\n";
+    auto sleep = [](std::chrono::steady_clock::time_point deadline) { std::this_thread::sleep_until(deadline); };
+    {
+        ADS_set<unsigned, 3> a;
+        bench_maintain_one("splits in insert    ", a, n, sleep);
+    }
+    {
+        ADS_set<unsigned, 3, ADS_deamortized_layout<>> a;
+        bench_maintain_one("... deamortized     ", a, n, sleep);
+    }
+    {
+        ADS_set<unsigned, 3, ADS_deferred_layout<>> a;
+        bench_maintain_one("maintain() when idle", a, n, [&a](std::chrono::steady_clock::time_point deadline) {
+            a.maintain(std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()));
+            std::this_thread::sleep_until(deadline);
+        });
+    }
+    {
+        maintained_ads_set<unsigned, 3> a;
+        bench_maintain_one("maintenance thread  ", a, n, sleep);
+    }
+    {
+        maintained_ads_set<unsigned, 3, ADS_deferred_layout<ADS_deamortized_layout<>>> a;
+        bench_maintain_one("... deamortized     ", a, n, sleep);
+    }
+}
+
+template <typename Set>
+void bench_split_one(char const* name, std::vector<unsigned> const& keys) {
+    in_child([&] {
+        size_t before = resident_bytes();
+        Set a;
+        double elapsed_insert = elapsed_ms([&] {
+            for(auto k: keys) a.insert(k);
+        });
+        size_t bytes = resident_bytes() - before;
+        size_t found = 0;
+        double elapsed_count = elapsed_ms([&] {
+            for(auto k: keys) found += a.count(k);
+        });
+        if(found != keys.size()) std::abort();
+
+        size_t buckets = 0, longest = 0;
+        for(size_t i = 0; i < a.bucket_count(); ++i) {
+            buckets += a.chain_length(i);
+            longest = std::max(longest, a.chain_length(i));
+        }
+        std::cerr << "  " << name << ": " << double(bytes) / double(keys.size()) << " bytes/key, slots = "
+                  << a.bucket_count() << ", chain = " << double(buckets) / double(a.bucket_count()) << " avg "
+                  << longest << " max, insert = " << double(keys.size()) / elapsed_insert / 1000 << " M/s, count = "
+                  << double(keys.size()) / elapsed_count / 1000 << " M/s\n";
+    });
+}
+
+template <size_t Size>
+void bench_split_size(std::vector<unsigned> const& keys) {
+    std::string name = "N=" + std::to_string(Size);
+    bench_split_one<ADS_set<unsigned, Size>>((name + " load factor").c_str(), keys);
+    bench_split_one<ADS_set<unsigned, Size, ADS_split_layout<ADS_overflow_split>>>((name + " on overflow").c_str(), keys);
+    bench_split_one<ADS_set<unsigned, Size, ADS_split_layout<ADS_chain_split<2>>>>((name + " chain <= 2").c_str(), keys);
+}
+
+void bench_split(size_t n) {
+    // uniform: scrambled by an odd multiplier; skewed: 3/4 of the keys are
+    // multiples of 16, so with the identity hash they crowd 1/16 of the slots
+    std::vector<unsigned> uniform(n), skewed(n);
+    for(size_t i = 0; i < n; ++i) {
+        uniform[i] = unsigned(i * 2654435761u);
+        skewed[i] = i % 4 ? unsigned(i << 4) : unsigned(i * 2654435761u) | 1;
+    }
+    std::sort(skewed.begin(), skewed.end());
+    skewed.erase(std::unique(skewed.begin(), skewed.end()), skewed.end());
+    std::shuffle(skewed.begin(), skewed.end(), RNG{9});
+
+    std::cerr << "split (n = " << n << ", uniform unsigned)\n";
+    bench_split_size<3>(uniform);
+    bench_split_size<16>(uniform);
+    std::cerr << "split (n = " << skewed.size() << ", skewed unsigned)\n";
+    bench_split_size<3>(skewed);
+    bench_split_size<16>(skewed);
+}
+
+// Probe length and overflow buckets are averaged over 16 points spread
+// over the inserts, so they cover all positions within a round
+template <typename Set>
+void bench_probe_one(char const* name, std::vector<unsigned> const& keys) {
+    in_child([&] {
+        size_t before = resident_bytes();
+        Set a;
+        size_t const points = 16;
+        double elapsed_insert = 0, probes = 0, worst = 0, overflow = 0, chains = 0;
+        for(size_t c = 0; c < points; ++c) {
+            size_t first = keys.size() * c / points, last = keys.size() * (c + 1) / points;
+            elapsed_insert += elapsed_ms([&] {
+                for(size_t i = first; i < last; ++i) a.insert(keys[i]);
+            });
+            double probe = a.average_probe_length();
+            probes += probe / points;
+            worst = std::max(worst, probe);
+            size_t buckets = 0, overflowing = 0;
+            for(size_t i = 0; i < a.bucket_count(); ++i) {
+                buckets += a.chain_length(i);
+                overflowing += a.chain_length(i) > 1;
+            }
+            overflow += double(buckets - a.bucket_count()) / double(a.bucket_count()) / points;
+            chains += double(overflowing) / double(a.bucket_count()) / points;
+        }
+        size_t bytes = resident_bytes() - before;
+        size_t found = 0;
+        double elapsed_count = elapsed_ms([&] {
+            for(auto k: keys) found += a.count(k);
+        });
+        if(found != keys.size()) std::abort();
+        std::cerr << "  " << name << ": " << double(bytes) / double(keys.size()) << " bytes/key, probe = " << probes
+                  << " avg " << worst << " max, overflow buckets/slot = " << overflow
+                  << ", chains/slot = " << chains << ", insert = "
+                  << double(keys.size()) / elapsed_insert / 1000 << " M/s, count = "
+                  << double(keys.size()) / elapsed_count / 1000 << " M/s\n";
+    });
+}
+
+template <size_t Size>
+void bench_partial_size(std::vector<unsigned> const& keys) {
+    std::string name = "N=" + std::to_string(Size);
+    bench_probe_one<ADS_set<unsigned, Size>>((name + " split/rehash").c_str(), keys);
+    bench_probe_one<ADS_set<unsigned, Size, ADS_partial_layout<>>>((name + " partial").c_str(), keys);
+}
+
+// random keys: multiples of an odd number would fill the low bit slots of
+// split/rehash perfectly evenly under the identity hash
+std::vector<unsigned> random_keys(size_t n) {
+    std::vector<unsigned> keys(n);
+    RNG random{7};
+    for(auto& k: keys) k = unsigned(random());
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::shuffle(keys.begin(), keys.end(), random);
+    return keys;
+}
+
+void bench_partial(size_t n) {
+    std::vector<unsigned> keys = random_keys(n);
+    std::cerr << "partial expansions (n = " << keys.size() << ", random unsigned)\n";
+    bench_partial_size<1>(keys);
+    bench_partial_size<3>(keys);
+    bench_partial_size<8>(keys);
+    bench_partial_size<16>(keys);
+}
+
+template <size_t Size>
+void bench_spiral_size(std::vector<unsigned> const& keys) {
+    std::string name = "N=" + std::to_string(Size);
+    bench_probe_one<ADS_set<unsigned, Size>>((name + " linear").c_str(), keys);
+    bench_probe_one<ADS_set<unsigned, Size, ADS_spiral_layout<>>>((name + " spiral").c_str(), keys);
+}
+
+// both at the default maximum load factor
+void bench_spiral(size_t n) {
+    std::vector<unsigned> keys = random_keys(n);
+    std::cerr << "spiral storage (n = " << keys.size() << ", random unsigned)\n";
+    bench_spiral_size<1>(keys);
+    bench_spiral_size<3>(keys);
+    bench_spiral_size<8>(keys);
+    bench_spiral_size<16>(keys);
+}
+
+// The phases of btest's stresstest2 on shuffled keys, each engine in a fresh
+// process; bytes/key is the RSS growth over the inserts
+template <typename Set>
+void bench_engine_one(char const* name, std::vector<size_t> keys) {
+    in_child([&] {
+        RNG random{11};
+        size_t before = resident_bytes();
+        Set a;
+        double elapsed_insert = elapsed_ms([&] {
+            for(auto k: keys) a.insert(k);
+        });
+        size_t bytes = resident_bytes() - before;
+        std::shuffle(keys.begin(), keys.end(), random);
+        size_t found = 0;
+        double elapsed_count = elapsed_ms([&] {
+            for(auto k: keys) found += a.count(k);
+        });
+        std::shuffle(keys.begin(), keys.end(), random);
+        double elapsed_find = elapsed_ms([&] {
+            for(auto k: keys) found += a.find(k) != a.end();
+        });
+        size_t sum = 0;
+        double elapsed_iter = elapsed_ms([&] {
+            for(auto k: a) sum += k;
+        });
+        std::shuffle(keys.begin(), keys.end(), random);
+        double elapsed_erase = elapsed_ms([&] {
+            for(auto k: keys) found += a.erase(k);
+        });
+        if(found != 3 * keys.size() || sum != keys.size() * (keys.size() - 1) / 2 || !a.empty()) std::abort();
+        std::cerr << "  " << name << ": " << double(bytes) / double(keys.size()) << " bytes/key, insert = "
+                  << elapsed_insert << " ms, count = " << elapsed_count << " ms, find = " << elapsed_find
+                  << " ms, iter = " << elapsed_iter << " ms, erase = " << elapsed_erase << " ms\n";
+    });
+}
+
+template <size_t Size>
+void bench_engines_size(std::vector<size_t> const& keys) {
+    std::string name = "N=" + std::to_string(Size);
+    bench_engine_one<ADS_set<size_t, Size>>((name + " linear").c_str(), keys);
+    // unbounded, the directory of buckets of 3 keys needs 2^31 entries for 10M keys
+    if(Size >= 8) bench_engine_one<extendible_ads_set<size_t, Size>>((name + " extendible").c_str(), keys);
+    bench_engine_one<extendible_ads_set<size_t, Size, extendible_capped_directory<4>>>(
+            (name + " extendible capped").c_str(), keys);
+}
+
+void bench_engines(size_t n) {
+    std::vector<size_t> keys(n);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), RNG{5});
+    std::cerr << "engines (n = " << n << ", shuffled size_t)\n";
+    bench_engines_size<3>(keys);
+    bench_engines_size<8>(keys);
+    bench_engines_size<16>(keys);
+}
+
 int main(int argc, char** argv) {
 //    btest_main(argc, argv);
-
-    do_the_thing(100000);
+    std::string bench = argc > 1 ? argv[1] : "insert";
+    size_t n = argc > 2 ? std::stoull(argv[2]) : 100000;
+
+    if(bench == "insert") {
+        do_the_thing(n);
+    } else if(bench == "copy") {
+        bench_copy(n);
+    } else if(bench == "equal") {
+        bench_equal(n);
+    } else if(bench == "iterate") {
+        bench_iterate(n);
+    } else if(bench == "for_each") {
+        bench_for_each(n);
+    } else if(bench == "sparse") {
+        bench_sparse(n);
+    } else if(bench == "snapshot") {
+        bench_snapshot(n);
+    } else if(bench == "frozen") {
+        bench_frozen(n);
+    } else if(bench == "disk") {
+        bench_disk(n);
+    } else if(bench == "wal") {
+        bench_wal(n);
+    } else if(bench == "layout") {
+        bench_layout(n);
+    } else if(bench == "compact") {
+        bench_compact(n);
+    } else if(bench == "strings") {
+        bench_strings(n);
+    } else if(bench == "trivial") {
+        bench_trivial(n);
+    } else if(bench == "sorted") {
+        bench_sorted(n);
+    } else if(bench == "filter") {
+        bench_filter(n);
+    } else if(bench == "algebra") {
+        bench_algebra(n);
+    } else if(bench == "small") {
+        bench_small(n);
+    } else if(bench == "clear") {
+        bench_clear(n);
+    } else if(bench == "latency") {
+        bench_latency(n);
+    } else if(bench == "maintain") {
+        bench_maintain(n);
+    } else if(bench == "split") {
+        bench_split(n);
+    } else if(bench == "partial") {
+        bench_partial(n);
+    } else if(bench == "spiral") {
+        bench_spiral(n);
+    } else if(bench == "engines") {
+        bench_engines(n);
+    } else {
+        std::cerr << "usage: " << argv[0] << " [insert|copy|equal|iterate|for_each|sparse|snapshot|frozen|disk|wal|layout|compact|strings|trivial|sorted|filter|algebra|small|clear|latency|maintain|split|partial|spiral|engines] [n]\n";
+        return 1;
+    }
     return 0;
 }
-
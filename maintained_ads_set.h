@@ -0,0 +1,114 @@
+#ifndef MAINTAINED_ADS_SET_H
+#define MAINTAINED_ADS_SET_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "ADS_set.h"
+
+// ADS_set whose splits run on a background maintenance thread.
+//
+// The set uses ADS_deferred_layout, so insert() only adds the key to its
+// chain and leaves split()/rehash() to ADS_set::maintain(). An insert that
+// leaves the set above its maximum load factor wakes the worker, which calls
+// maintain(budget) until nothing is due. Every operation takes one mutex and
+// the worker gives it up after each budget, so a foreground call waits for
+// at most about one budget of split work.
+template<typename Key, size_t N = 3, typename Layout = ADS_deferred_layout<>>
+class maintained_ads_set {
+public:
+    using set_type = ADS_set<Key, N, Layout>;
+    using key_type = Key;
+    using size_type = size_t;
+
+    static_assert(Layout::deferred, "maintained_ads_set needs a deferred layout");
+
+private:
+    set_type set_;
+    std::chrono::microseconds budget_;
+    mutable std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stop_{false};
+    std::thread worker_;
+
+    void run() {
+        std::unique_lock<std::mutex> lock{mutex_};
+        while (!stop_) {
+            if (!set_.needs_maintenance()) {
+                wakeup_.wait(lock);
+                continue;
+            }
+            set_.maintain(budget_);
+            // let waiting foreground calls in before the next slice
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+    }
+
+public:
+    explicit maintained_ads_set(std::chrono::microseconds budget = std::chrono::microseconds{50})
+            : budget_{budget}
+            , worker_{&maintained_ads_set::run, this}
+    {}
+
+    maintained_ads_set(const maintained_ads_set&) = delete;
+    maintained_ads_set& operator=(const maintained_ads_set&) = delete;
+
+    ~maintained_ads_set() {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            stop_ = true;
+        }
+        wakeup_.notify_one();
+        worker_.join();
+    }
+
+    bool insert(const key_type& key) {
+        bool inserted, due;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            inserted = set_.insert(key).second;
+            due = set_.needs_maintenance();
+        }
+        if (due) wakeup_.notify_one();
+        return inserted;
+    }
+
+    size_type erase(const key_type& key) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return set_.erase(key);
+    }
+
+    size_type count(const key_type& key) const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return set_.count(key);
+    }
+
+    size_type size() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return set_.size();
+    }
+
+    size_type bucket_count() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return set_.bucket_count();
+    }
+
+    // f(key) for every key, with the set locked
+    template<typename F>
+    void for_each(F&& f) const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        set_.for_each(f);
+    }
+
+    // Does all pending splits in the calling thread
+    void drain() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        while (set_.needs_maintenance()) set_.maintain(budget_);
+    }
+};
+
+#endif // MAINTAINED_ADS_SET_H
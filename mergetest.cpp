@@ -0,0 +1,200 @@
+// Allocation test for ADS_set::merge(), extract() and insert(node_type&&)
+//
+// Global operator new is replaced by a counting one. Moving keys between
+// sets with extract()/insert() and merge() must not copy them, so with long
+// std::string keys (which own heap buffers) and a warmed up target set no
+// allocations may happen at all; merging into a growing set may only
+// allocate for directory growth, a handful of times independent of n. The
+// contents are checked against std::set. A merge whose key comparison
+// throws part way must leave every key in one of the two sets.
+//
+// g++ -Wall -Wextra -O2 --std=c++14 mergetest.cpp -o mergetest && ./mergetest [n]
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ADS_set.h"
+#include "testutil.h"
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// 40 characters, well beyond the short string buffer
+std::string long_key(size_t i) {
+    std::string key = make_key<std::string>(i);
+    return std::string(40 - key.size(), 'k') + key;
+}
+
+template<typename Set>
+int merge_test(size_t n, size_t limit, const char* name) {
+    using Key = typename Set::key_type;
+    Set a, b;
+    std::set<Key> expected;
+    for (size_t i = 0; i < n; ++i) {
+        Key key = long_key(i);
+        a.insert(key);
+        expected.insert(key);
+    }
+    for (size_t i = n / 2; i < n + n / 2; ++i) {
+        Key key = long_key(i);
+        b.insert(key);
+        expected.insert(key);
+    }
+
+    size_t before = allocations;
+    a.merge(std::move(b));
+    size_t used = allocations - before;
+    std::cerr << name << ": merge of " << n << " into " << n << " keys, " << used << " allocations\n";
+    if (!b.empty() || !same(a, expected)) return fail("merge lost or duplicated keys");
+    if (used > limit) return fail("merge allocates per key");
+    return 0;
+}
+
+// compares counts down the comparisons left until one throws, 0 never throws
+static size_t compares = 0;
+
+struct Fragile {
+    std::string value;
+};
+
+bool operator==(const Fragile& lhs, const Fragile& rhs) {
+    if (compares && 0 == --compares) throw std::runtime_error("comparison failed");
+    return lhs.value == rhs.value;
+}
+
+bool operator<(const Fragile& lhs, const Fragile& rhs) { return lhs.value < rhs.value; }
+
+namespace std {
+    template<>
+    struct hash<Fragile> {
+        size_t operator()(const Fragile& key) const { return hash<string>{}(key.value); }
+    };
+}
+
+// a merge that throws after `after` comparisons must leave every key in
+// one of the sets, both of them consistent and usable
+template<typename Set>
+int merge_throws(size_t na, size_t nb, const char* name) {
+    int errors = 0;
+    for (size_t after: {1, 2, 10, 100, 1000, 10000}) {
+        Set a, b;
+        std::set<Fragile> expected, kept;
+        for (size_t i = 0; i < na; ++i) {
+            a.insert(Fragile{long_key(i)});
+            kept.insert(Fragile{long_key(i)});
+        }
+        for (size_t i = na / 2; i < na / 2 + nb; ++i) {
+            b.insert(Fragile{long_key(i)});
+        }
+        expected = kept;
+        for (const Fragile& key: b) {
+            expected.insert(key);
+        }
+
+        compares = after;
+        try {
+            a.merge(std::move(b));
+        } catch (const std::runtime_error&) {
+        }
+        compares = 0;
+
+        std::string what = std::string(name) + ", " + std::to_string(na) + " and " + std::to_string(nb)
+                + " keys, throwing after " + std::to_string(after) + " comparisons: ";
+        std::set<Fragile> inA{a.begin(), a.end()}, inB{b.begin(), b.end()}, both = inA;
+        both.insert(inB.begin(), inB.end());
+        if (!same(a, inA) || !same(b, inB)) errors += fail(what + "inconsistent sets");
+        if (!std::includes(inA.begin(), inA.end(), kept.begin(), kept.end())) errors += fail(what + "lost keys of the target");
+        if (both != expected) errors += fail(what + "lost keys of the source");
+
+        // both sets still work, and merging again completes the first merge
+        Fragile extra{long_key(na + nb)};
+        b.insert(extra);
+        expected.insert(extra);
+        a.merge(std::move(b));
+        if (!b.empty() || !same(a, expected)) errors += fail(what + "second merge");
+    }
+    return errors;
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::stoul(argv[1]) : 100000;
+    using set = ADS_set<std::string, 7>;
+    int errors = 0;
+
+    // extract/insert ping-pong: once b has seen all keys, nothing allocates
+    {
+        set a, b;
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < n; ++i) {
+            keys.push_back(long_key(i));
+        }
+        std::set<std::string> expected{keys.begin(), keys.end()};
+        a.insert(keys.begin(), keys.end());
+        for (size_t round = 0; round < 2; ++round) {
+            size_t before = allocations;
+            for (size_t i = 0; i < n; ++i) {
+                if (!b.insert(a.extract(keys[i])).inserted) errors += fail("extract/insert did not move the key");
+            }
+            for (size_t i = 0; i < n; ++i) {
+                auto node = b.extract(keys[i]);
+                if (!node || node.value() != keys[i]) errors += fail("extract returned the wrong key");
+                if (!a.insert(std::move(node)).inserted) errors += fail("insert(node) failed");
+            }
+            size_t used = allocations - before;
+            std::cerr << "extract/insert round " << round << ": " << used << " allocations\n";
+            if (round && used) errors += fail("extract/insert allocates");
+        }
+        if (!b.empty() || !same(a, expected)) errors += fail("extract/insert lost keys");
+
+        auto node = a.extract(long_key(n));
+        if (node || !node.empty()) errors += fail("extract of a missing key returned a key");
+        node = a.extract(a.begin());
+        std::string key = node.value();
+        auto result = a.insert(std::move(node));
+        if (!result.inserted || *result.position != key || result.node) errors += fail("insert(node) result");
+        result = b.insert(set::node_type{});
+        if (result.inserted || result.node || result.position != b.end()) errors += fail("insert of an empty node");
+    }
+
+    // duplicates are kept by the target, the rejected node comes back
+    {
+        set a{long_key(1)}, b{long_key(1)};
+        auto result = a.insert(b.extract(long_key(1)));
+        if (result.inserted || !result.node || result.node.value() != long_key(1) || a.size() != 1 || !b.empty())
+            errors += fail("insert of a duplicate node");
+    }
+
+    // the merge adds n / 2 keys: one directory doubling, some buckets, filters
+    errors += merge_test<set>(n, 200, "pointer buckets");
+    errors += merge_test<ADS_set<std::string, 7, ADS_compact_layout>>(n, 200, "compact buckets");
+    errors += merge_test<ADS_set<std::string, 7, ADS_sorted_layout<ADS_filter_layout<>>>>(n, 200, "sorted, filtered");
+
+    // a key comparison throws part way through the merge
+    for (size_t nb: {2, 1000}) {
+        errors += merge_throws<ADS_set<Fragile, 7>>(1000, nb, "pointer buckets");
+        errors += merge_throws<ADS_set<Fragile, 7, ADS_compact_layout>>(1000, nb, "compact buckets");
+        errors += merge_throws<ADS_set<Fragile, 3, ADS_deamortized_layout<ADS_sorted_layout<ADS_filter_layout<>>>>>(
+                1000, nb, "deamortized, sorted, filtered");
+        errors += merge_throws<ADS_set<Fragile, 3, ADS_partial_layout<>>>(1000, nb, "partial");
+        errors += merge_throws<ADS_set<Fragile, 3, ADS_spiral_layout<>>>(1000, nb, "spiral");
+        errors += merge_throws<ADS_set<Fragile, 7>>(2, nb, "pointer buckets into a small set");
+    }
+
+    if (errors) return 1;
+    std::cout << "OK\n";
+    return 0;
+}
@@ -0,0 +1,208 @@
+// Round trip test for ADS_set::save() and load()
+//
+// Sets of many sizes are saved and loaded into every layout of the same N
+// and addressing, and the loaded set is compared key by key and with
+// operator== against a set built by inserts. Every prefix of a small
+// snapshot, prefixes of a large one and snapshots with corrupted header
+// fields, directories larger than the data or string lengths must make
+// load() throw std::runtime_error and leave the target set as it was.
+//
+// g++ -Wall -Wextra -O2 --std=c++14 snapshottest.cpp -o snapshottest && ./snapshottest
+
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ADS_set.h"
+#include "testutil.h"
+
+// scattered over the whole range of unsigned, strings of many lengths
+template<typename Key>
+Key key(size_t i);
+
+template<>
+unsigned key<unsigned>(size_t i) { return make_key<unsigned>(i * 2654435761u); }
+
+template<>
+std::string key<std::string>(size_t i) { return std::string(i % 40, 's') + make_key<std::string>(i); }
+
+template<typename Set>
+std::string save(const Set& set) {
+    std::ostringstream o;
+    set.save(o);
+    return o.str();
+}
+
+// load() of data must throw and leave target alone
+template<typename Set>
+int rejects(const std::string& data, Set& target, const std::string& what) {
+    Set before{target};
+    std::istringstream i{data};
+    try {
+        target.load(i);
+    } catch (const std::runtime_error&) {
+        return target == before ? 0 : fail(what + ": failed load() changed the set");
+    }
+    return fail(what + ": load() accepted it");
+}
+
+// n keys saved from a From set, loaded into a To set
+template<typename From, typename To>
+int round_trip(const std::string& name, size_t n) {
+    using Key = typename From::key_type;
+    std::set<Key> expected;
+    From from;
+    for (size_t i = 0; i < n; ++i) {
+        from.insert(key<Key>(i));
+        expected.insert(key<Key>(i));
+    }
+    // erased keys leave holes in the buckets
+    for (size_t i = 0; i < n; i += 3) {
+        from.erase(key<Key>(i));
+        expected.erase(key<Key>(i));
+    }
+    To to{key<Key>(n + 1)};
+    std::istringstream i{save(from)};
+    to.load(i);
+    To built{expected.begin(), expected.end()};
+    std::string what = name + ", " + std::to_string(n) + " keys";
+    if (!same(to, expected)) return fail(what + ": contents differ");
+    if (!(to == built) || to != built) return fail(what + ": operator== differs");
+    // the loaded set keeps working
+    to.insert(key<Key>(n + 1));
+    to.erase(key<Key>(1));
+    expected.insert(key<Key>(n + 1));
+    expected.erase(key<Key>(1));
+    return same(to, expected) ? 0 : fail(what + ": inserts after load() fail");
+}
+
+template<typename From, typename To>
+int round_trips(const std::string& name) {
+    int errors = 0;
+    for (size_t n: {0, 1, 2, 3, 4, 5, 17, 1000, 30000}) {
+        errors += round_trip<From, To>(name, n);
+    }
+    return errors;
+}
+
+// Header: magic, version, key size, N, load factor, addressing (4 bytes
+// each), then d, nextToSplit, tableSize and size (8 bytes each)
+template<typename Set>
+int corruption(const std::string& name) {
+    using Key = typename Set::key_type;
+    int errors = 0;
+    Set target{key<Key>(7), key<Key>(8)};
+    Set small{key<Key>(1), key<Key>(2)}, large;
+    for (size_t i = 0; i < 5000; ++i) {
+        large.insert(key<Key>(i));
+    }
+    std::string smallData = save(small), largeData = save(large);
+
+    for (size_t length = 0; length < smallData.size(); ++length) {
+        errors += rejects(smallData.substr(0, length), target, name + " small snapshot cut at " + std::to_string(length));
+    }
+    std::mt19937_64 random{3};
+    for (size_t k = 0; k < 50; ++k) {
+        size_t length = random() % largeData.size();
+        errors += rejects(largeData.substr(0, length), target, name + " large snapshot cut at " + std::to_string(length));
+    }
+
+    struct Field {
+        size_t offset;
+        size_t bytes;
+        uint64_t value;
+        const char* what;
+    };
+    for (const Field& field: {Field{0, 1, 'X', "magic"}, Field{4, 4, 99, "version"}, Field{8, 4, 3, "key size"},
+                              Field{12, 4, 1000, "N"}, Field{20, 4, 7, "addressing"}, Field{24, 8, 70, "d"},
+                              Field{32, 8, uint64_t(1) << 40, "nextToSplit"}, Field{40, 8, 12345, "tableSize"}}) {
+        for (const std::string* data: {&smallData, &largeData}) {
+            std::string corrupt = *data;
+            std::memcpy(&corrupt[field.offset], &field.value, field.bytes);
+            errors += rejects(corrupt, target, name + " corrupt " + field.what);
+        }
+    }
+    // a valid directory of 2^d slots with too few chains behind it, down to
+    // none, must fail before the directory is allocated
+    for (uint64_t d: {20, 40, 62}) {
+        for (size_t length: {size_t(56), largeData.size()}) {
+            std::string corrupt = largeData.substr(0, length);
+            uint64_t nextToSplit = 0, tableSize = uint64_t(1) << d;
+            std::memcpy(&corrupt[24], &d, 8);
+            std::memcpy(&corrupt[32], &nextToSplit, 8);
+            std::memcpy(&corrupt[40], &tableSize, 8);
+            errors += rejects(corrupt, target, name + " header of 2^" + std::to_string(d) + " slots");
+        }
+    }
+    for (float loadFactor: {0.0f, -1.0f, std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN()}) {
+        for (const std::string* data: {&smallData, &largeData}) {
+            std::string corrupt = *data;
+            std::memcpy(&corrupt[16], &loadFactor, 4);
+            errors += rejects(corrupt, target, name + " load factor " + std::to_string(loadFactor));
+        }
+    }
+    for (const std::string* data: {&smallData, &largeData}) {
+        std::string corrupt = *data;
+        uint64_t size;
+        std::memcpy(&size, &corrupt[48], 8);
+        ++size;
+        std::memcpy(&corrupt[48], &size, 8);
+        errors += rejects(corrupt, target, name + " corrupt size");
+    }
+    return errors;
+}
+
+// a string length far beyond the end of the stream
+int corrupt_length() {
+    ADS_set<std::string> target{"t"}, small{"a"};
+    std::string corrupt = save(small);
+    uint64_t length = uint64_t(1) << 40;
+    // header, then the chain length of the one slot, then the first key
+    std::memcpy(&corrupt[56 + 8], &length, 8);
+    return rejects(corrupt, target, "string length 2^40");
+}
+
+int main() {
+    int errors = 0;
+
+    errors += round_trips<ADS_set<unsigned>, ADS_set<unsigned>>("default");
+    errors += round_trips<ADS_set<unsigned, 1>, ADS_set<unsigned, 1>>("default N=1");
+    errors += round_trips<ADS_set<unsigned>, ADS_set<unsigned, 3, ADS_compact_layout>>("default to compact");
+    errors += round_trips<ADS_set<unsigned, 3, ADS_compact_layout>, ADS_set<unsigned>>("compact to default");
+    errors += round_trips<ADS_set<unsigned>, ADS_set<unsigned, 3, ADS_sorted_layout<ADS_filter_layout<>>>>(
+            "default to sorted, filter");
+    errors += round_trips<ADS_set<unsigned, 3, ADS_filter_layout<>>, ADS_set<unsigned, 3, ADS_deamortized_layout<>>>(
+            "filter to deamortized");
+    errors += round_trips<ADS_set<unsigned, 3, ADS_deferred_layout<>>, ADS_set<unsigned>>("deferred to default");
+    errors += round_trips<ADS_set<unsigned>, ADS_set<unsigned, 3, ADS_split_layout<ADS_overflow_split>>>(
+            "default to split on overflow");
+    errors += round_trips<ADS_set<unsigned, 3, ADS_partial_layout<>>, ADS_set<unsigned, 3, ADS_partial_layout<ADS_compact_layout>>>(
+            "partial to partial compact");
+    errors += round_trips<ADS_set<unsigned, 3, ADS_spiral_layout<ADS_compact_layout>>, ADS_set<unsigned, 3, ADS_spiral_layout<>>>(
+            "spiral compact to spiral");
+    errors += round_trips<ADS_set<std::string>, ADS_set<std::string>>("strings");
+    errors += round_trips<ADS_set<std::string>, ADS_set<std::string, 3, ADS_compact_layout>>("strings to compact");
+    errors += round_trips<ADS_set<std::string, 3, ADS_sorted_layout<>>, ADS_set<std::string>>("sorted strings to default");
+
+    errors += corruption<ADS_set<unsigned>>("default");
+    errors += corruption<ADS_set<unsigned, 3, ADS_compact_layout>>("compact");
+    errors += corruption<ADS_set<unsigned, 3, ADS_partial_layout<>>>("partial");
+    errors += corruption<ADS_set<std::string>>("strings");
+    errors += corrupt_length();
+
+    // a snapshot only loads with its own key size, N and addressing
+    ADS_set<unsigned> linear{1, 2, 3};
+    ADS_set<unsigned, 4> wider;
+    ADS_set<unsigned, 3, ADS_spiral_layout<>> spiral;
+    errors += rejects(save(linear), wider, "snapshot of another N");
+    errors += rejects(save(linear), spiral, "snapshot of another addressing");
+
+    if (errors) return 1;
+    std::cout << "OK\n";
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+// Helpers shared by the standalone tests
+
+#include <iostream>
+#include <set>
+#include <string>
+
+// Distinct keys for distinct i
+template<typename Key>
+Key make_key(size_t i);
+
+template<>
+inline unsigned make_key<unsigned>(size_t i) { return unsigned(i); }
+
+template<>
+inline std::string make_key<std::string>(size_t i) { return "key" + std::to_string(i); }
+
+inline int fail(const std::string& what) {
+    std::cerr << "ERROR: " << what << "\n";
+    return 1;
+}
+
+// set holds exactly the keys of expected, by size(), iteration and count()
+template<typename Set>
+bool same(const Set& set, const std::set<typename Set::key_type>& expected) {
+    if (set.size() != expected.size()) return false;
+    size_t n = 0;
+    for (const auto& key: set) {
+        if (!expected.count(key)) return false;
+        ++n;
+    }
+    for (const auto& key: expected) {
+        if (!set.count(key)) return false;
+    }
+    return n == expected.size();
+}
+
+#endif // TESTUTIL_H
@@ -0,0 +1,319 @@
+#ifndef WAL_ADS_SET_H
+#define WAL_ADS_SET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ADS_set.h"
+
+// ADS_set made durable with a snapshot plus a write-ahead log.
+//
+// Every successful insert/erase appends a record to `path.wal`; a split done
+// by the insert appends a SPLIT record with the resulting bucket count.
+// Records are buffered and written with one write() + fdatasync() per group of
+// `groupSize` records (or on commit()), which amortizes the fsync over the
+// group. checkpoint() writes `path.snapshot` via ADS_set::save() and starts a
+// fresh log; both files carry an epoch so a log older than the snapshot is
+// ignored. Opening loads the snapshot and replays the log on top of it,
+// stopping at the first torn or corrupt record.
+//
+// A commit whose write fails cuts the log back to the end of the last commit,
+// so retrying it cannot leave a torn group in front of later records; if that
+// fails too, or fdatasync() fails, the log is broken and commits throw until
+// the set is opened again.
+//
+// Only the in-memory set is ever modified in place, so a crash in the middle
+// of split()/rehash() loses at most the records not yet committed. Since
+// splits are deterministic, replaying the inserts redoes them; SPLIT records
+// check that the replay arrives at the same layout.
+template<typename Key, size_t N = 3, typename Serializer = ADS_serializer<Key>>
+class wal_ads_set {
+public:
+    using set_type = ADS_set<Key, N>;
+    using key_type = Key;
+    using size_type = size_t;
+
+private:
+    enum Record : uint8_t { INSERT = 1, ERASE = 2, SPLIT = 3 };
+
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t epoch;
+    };
+    static const uint32_t VERSION = 1;
+
+    std::string path_;
+    set_type set_;
+    uint64_t epoch_{0};
+    int log_{-1};
+    // end of the last commit in the log, and whether the log may hold more
+    off_t committed_{0};
+    bool broken_{false};
+    size_t groupSize_;
+    size_t pending_{0};
+    std::string buffer_;
+    std::ostringstream keyBuffer_;
+    std::istringstream recordBuffer_;
+
+    static uint32_t checksum(const char* data, size_t n) {
+        // FNV-1a
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < n; ++i) {
+            h = (h ^ uint8_t(data[i])) * 16777619u;
+        }
+        return h;
+    }
+
+    template<typename T>
+    static void append(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    // [uint32 payload length][uint8 type][payload][uint32 checksum of type and payload]
+    void appendRecord(Record type, const std::string& payload) {
+        size_t start = buffer_.size();
+        append(buffer_, uint32_t(payload.size()));
+        buffer_.push_back(char(type));
+        buffer_ += payload;
+        append(buffer_, checksum(&buffer_[start + sizeof(uint32_t)], 1 + payload.size()));
+        if (++pending_ >= groupSize_) commit();
+    }
+
+    void appendKey(Record type, const Key& key) {
+        keyBuffer_.str(std::string{});
+        Serializer::write(keyBuffer_, &key, 1);
+        appendRecord(type, keyBuffer_.str());
+    }
+
+    static void writeAll(int fd, const char* data, size_t n) {
+        while (n) {
+            ssize_t written = ::write(fd, data, n);
+            if (written <= 0) throw std::runtime_error("wal_ads_set: write failed");
+            data += written;
+            n -= size_t(written);
+        }
+    }
+
+    static void syncDirectory(const std::string& path) {
+        size_t slash = path.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int fd = ::open(directory.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            fsync(fd);
+            ::close(fd);
+        }
+    }
+
+    // Writes a new, empty log for epoch_ and atomically puts it in place.
+    void resetLog() {
+        if (log_ >= 0) ::close(log_);
+        log_ = -1;
+
+        std::string tmp = path_ + ".wal.tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("wal_ads_set: cannot create " + tmp);
+        FileHeader header{{'A', 'D', 'S', 'W'}, VERSION, epoch_};
+        try {
+            writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header));
+            if (fsync(fd) != 0) throw std::runtime_error("wal_ads_set: fsync failed");
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        if (std::rename(tmp.c_str(), (path_ + ".wal").c_str()) != 0)
+            throw std::runtime_error("wal_ads_set: cannot replace " + path_ + ".wal");
+        syncDirectory(path_);
+        openLog();
+    }
+
+    void openLog() {
+        log_ = ::open((path_ + ".wal").c_str(), O_WRONLY | O_APPEND);
+        if (log_ < 0) throw std::runtime_error("wal_ads_set: cannot open " + path_ + ".wal");
+        committed_ = lseek(log_, 0, SEEK_END);
+        broken_ = committed_ < 0;
+    }
+
+    void loadSnapshot() {
+        std::ifstream i{path_ + ".snapshot", std::ios::binary};
+        if (!i) return;
+
+        FileHeader header;
+        if (!i.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, "ADSW", 4) != 0
+                || header.version != VERSION)
+            throw std::runtime_error("wal_ads_set: " + path_ + ".snapshot is not a snapshot");
+        set_.template load<Serializer>(i);
+        epoch_ = header.epoch;
+    }
+
+    // Replays the log if it belongs to the loaded snapshot and cuts off a torn
+    // tail; returns false if there is no usable log.
+    bool replayLog() {
+        std::ifstream i{path_ + ".wal", std::ios::binary};
+        if (!i) return false;
+        std::string log{std::istreambuf_iterator<char>(i), std::istreambuf_iterator<char>()};
+
+        FileHeader header;
+        if (log.size() < sizeof(header)) return false;
+        std::memcpy(&header, log.data(), sizeof(header));
+        if (std::memcmp(header.magic, "ADSW", 4) != 0 || header.version != VERSION || header.epoch != epoch_)
+            return false;
+
+        size_t offset = sizeof(header);
+        for (;;) {
+            uint32_t length, sum;
+            if (log.size() - offset < sizeof(length) + 1 + sizeof(sum)) break;
+            std::memcpy(&length, &log[offset], sizeof(length));
+            if (log.size() - offset - sizeof(length) - 1 - sizeof(sum) < length) break;
+            const char* body = &log[offset + sizeof(length)];
+            std::memcpy(&sum, body + 1 + length, sizeof(sum));
+            if (sum != checksum(body, 1 + length)) break;
+
+            apply(Record(body[0]), std::string(body + 1, length));
+            offset += sizeof(length) + 1 + length + sizeof(sum);
+        }
+
+        if (offset != log.size() && truncate((path_ + ".wal").c_str(), off_t(offset)) != 0)
+            throw std::runtime_error("wal_ads_set: cannot truncate " + path_ + ".wal");
+        return true;
+    }
+
+    void apply(Record type, const std::string& payload) {
+        std::istringstream& i = recordBuffer_;
+        i.str(payload);
+        i.clear();
+        if (SPLIT == type) {
+            uint64_t buckets = 0;
+            if (payload.size() != sizeof(buckets) || !i.read(reinterpret_cast<char*>(&buckets), sizeof(buckets)))
+                throw std::runtime_error("wal_ads_set: corrupt log record");
+            if (buckets != set_.bucket_count())
+                throw std::runtime_error("wal_ads_set: log replay diverged from the logged layout");
+            return;
+        }
+
+        // read() constructs the key, Key need not be default constructible
+        typename std::aligned_storage<sizeof(Key), alignof(Key)>::type storage;
+        Key* key = reinterpret_cast<Key*>(&storage);
+        Serializer::read(i, key, 1);
+        try {
+            if (!i) throw std::runtime_error("wal_ads_set: corrupt log record");
+            if (INSERT == type)
+                set_.insert(*key);
+            else if (ERASE == type)
+                set_.erase(*key);
+            else
+                throw std::runtime_error("wal_ads_set: unknown log record");
+        } catch (...) {
+            key->~Key();
+            throw;
+        }
+        key->~Key();
+    }
+
+public:
+    explicit wal_ads_set(const std::string& path, size_t groupSize = 64)
+            : path_{path}
+            , groupSize_{std::max<size_t>(1, groupSize)}
+    {
+        loadSnapshot();
+        if (replayLog())
+            openLog();
+        else
+            resetLog();
+    }
+
+    wal_ads_set(const wal_ads_set&) = delete;
+    wal_ads_set& operator=(const wal_ads_set&) = delete;
+
+    ~wal_ads_set() {
+        try {
+            commit();
+        } catch (...) {
+        }
+        if (log_ >= 0) ::close(log_);
+    }
+
+    const set_type& set() const { return set_; }
+    size_type size() const { return set_.size(); }
+    size_type count(const key_type& key) const { return set_.count(key); }
+
+    bool insert(const key_type& key) {
+        size_t buckets = set_.bucket_count();
+        if (!set_.insert(key).second) return false;
+
+        appendKey(INSERT, key);
+        if (set_.bucket_count() != buckets) {
+            std::string payload;
+            append(payload, uint64_t(set_.bucket_count()));
+            appendRecord(SPLIT, payload);
+        }
+        return true;
+    }
+
+    size_type erase(const key_type& key) {
+        if (!set_.erase(key)) return 0;
+        appendKey(ERASE, key);
+        return 1;
+    }
+
+    // Makes all records so far durable with a single write and fdatasync.
+    // If that fails the records stay buffered for another commit().
+    void commit() {
+        if (buffer_.empty()) return;
+        if (broken_) throw std::runtime_error("wal_ads_set: " + path_ + ".wal is broken");
+        try {
+            writeAll(log_, buffer_.data(), buffer_.size());
+        } catch (...) {
+            broken_ = ftruncate(log_, committed_) != 0;
+            throw;
+        }
+        // after a failed fdatasync() it is unknown which pages reached the disk
+        if (fdatasync(log_) != 0) {
+            broken_ = true;
+            throw std::runtime_error("wal_ads_set: fdatasync failed");
+        }
+        committed_ += off_t(buffer_.size());
+        buffer_.clear();
+        pending_ = 0;
+    }
+
+    // Writes a snapshot of the set and starts an empty log.
+    void checkpoint() {
+        commit();
+
+        std::string tmp = path_ + ".snapshot.tmp";
+        {
+            std::ofstream o{tmp, std::ios::binary | std::ios::trunc};
+            FileHeader header{{'A', 'D', 'S', 'W'}, VERSION, epoch_ + 1};
+            o.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            set_.template save<Serializer>(o);
+            if (!o.flush()) throw std::runtime_error("wal_ads_set: cannot write " + tmp);
+        }
+        int fd = ::open(tmp.c_str(), O_RDONLY);
+        if (fd < 0 || fsync(fd) != 0) {
+            if (fd >= 0) ::close(fd);
+            throw std::runtime_error("wal_ads_set: cannot sync " + tmp);
+        }
+        ::close(fd);
+        if (std::rename(tmp.c_str(), (path_ + ".snapshot").c_str()) != 0)
+            throw std::runtime_error("wal_ads_set: cannot replace " + path_ + ".snapshot");
+        syncDirectory(path_);
+
+        ++epoch_;
+        resetLog();
+    }
+};
+
+#endif // WAL_ADS_SET_H
@@ -0,0 +1,186 @@
+// Crash test for wal_ads_set.h
+//
+// A child process runs a fixed sequence of inserts and erases against a
+// wal_ads_set, commits every few steps, checkpoints now and then and reports
+// each commit through a pipe. The parent kills it with SIGKILL at a random
+// moment, reopens the set (recovery) and checks that it holds exactly the
+// effect of some prefix of the sequence that covers everything committed.
+// The next child continues on the recovered files. Before that, a commit is
+// torn by the file size limit and must leave the log as it was.
+//
+// g++ -Wall -Wextra -O2 --std=c++14 waltest.cpp -o waltest && ./waltest [rounds] [seed]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "wal_ads_set.h"
+
+using wal_set = wal_ads_set<unsigned>;
+
+const char* const PATH = "waltest.set";
+const size_t STEPS = 1000000;
+const size_t COMMIT_EVERY = 16;
+const size_t CHECKPOINT_EVERY = 5000;
+
+// step i inserts i, every fifth step also erases i - 2
+std::vector<std::pair<bool, unsigned>> make_ops() {
+    std::vector<std::pair<bool, unsigned>> ops;
+    for (unsigned i = 0; i < STEPS; ++i) {
+        ops.emplace_back(true, i);
+        if (i % 5 == 4) ops.emplace_back(false, i - 2);
+    }
+    return ops;
+}
+
+// Number of ops that lead to the state of w, derived from its largest key.
+size_t recovered_ops(const wal_set& w, const std::vector<std::pair<bool, unsigned>>& ops) {
+    if (!w.size()) return 0;
+    unsigned largest = 0;
+    w.set().for_each([&](unsigned key) { largest = std::max(largest, key); });
+
+    size_t k = 0;
+    while (!(ops[k].first && ops[k].second == largest)) ++k;
+    ++k;
+    if (k < ops.size() && !ops[k].first && !w.count(ops[k].second)) ++k;
+    return k;
+}
+
+bool check(const wal_set& w, const std::vector<std::pair<bool, unsigned>>& ops, size_t k) {
+    std::set<unsigned> expected;
+    for (size_t i = 0; i < k; ++i) {
+        if (ops[i].first)
+            expected.insert(ops[i].second);
+        else
+            expected.erase(ops[i].second);
+    }
+    if (expected.size() != w.size()) return false;
+    for (auto key: expected) {
+        if (!w.count(key)) return false;
+    }
+    return true;
+}
+
+[[noreturn]] void child(const std::vector<std::pair<bool, unsigned>>& ops, size_t from, int ack) {
+    wal_set w{PATH, size_t(-1)};
+    for (size_t i = from; i < ops.size(); ++i) {
+        if (ops[i].first)
+            w.insert(ops[i].second);
+        else
+            w.erase(ops[i].second);
+
+        if ((i + 1) % COMMIT_EVERY == 0) {
+            w.commit();
+            uint64_t done = i + 1;
+            if (write(ack, &done, sizeof(done)) != sizeof(done)) _exit(2);
+        }
+        if ((i + 1) % CHECKPOINT_EVERY == 0) w.checkpoint();
+    }
+    _exit(0);
+}
+
+void remove_files() {
+    for (const char* suffix: {".wal", ".wal.tmp", ".snapshot", ".snapshot.tmp"}) {
+        std::remove((std::string{PATH} + suffix).c_str());
+    }
+}
+
+off_t log_size() {
+    struct stat st;
+    return stat((std::string{PATH} + ".wal").c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+// A write cut short by RLIMIT_FSIZE, then a retried commit and one after it
+bool torn_commit() {
+    remove_files();
+    signal(SIGXFSZ, SIG_IGN);
+    struct rlimit unlimited;
+    if (getrlimit(RLIMIT_FSIZE, &unlimited) != 0) return false;
+    {
+        wal_set w{PATH, size_t(-1)};
+        for (unsigned i = 0; i < 100; ++i) w.insert(i);
+        w.commit();
+        off_t committed = log_size();
+        for (unsigned i = 100; i < 200; ++i) w.insert(i);
+
+        struct rlimit limit = unlimited;
+        limit.rlim_cur = rlim_t(committed + 100);
+        if (setrlimit(RLIMIT_FSIZE, &limit) != 0) return false;
+        bool threw = false;
+        try {
+            w.commit();
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        if (setrlimit(RLIMIT_FSIZE, &unlimited) != 0 || !threw || log_size() != committed) return false;
+
+        w.commit();
+        for (unsigned i = 200; i < 300; ++i) w.insert(i);
+        w.commit();
+    }
+    wal_set w{PATH};
+    bool recovered = w.size() == 300;
+    for (unsigned i = 0; i < 300; ++i) {
+        recovered = recovered && w.count(i);
+    }
+    remove_files();
+    return recovered;
+}
+
+int main(int argc, char** argv) {
+    size_t rounds = argc > 1 ? std::stoul(argv[1]) : 20;
+    std::mt19937_64 gen{argc > 2 ? std::stoull(argv[2]) : 666};
+    auto ops = make_ops();
+    if (!torn_commit()) {
+        std::cerr << "ERROR: a torn commit was not cut off the log\n";
+        return 1;
+    }
+    remove_files();
+
+    size_t from = 0;
+    for (size_t round = 0; round < rounds; ++round) {
+        int pipefd[2];
+        if (pipe(pipefd) != 0) return 1;
+
+        pid_t pid = fork();
+        if (pid < 0) return 1;
+        if (pid == 0) {
+            close(pipefd[0]);
+            child(ops, from, pipefd[1]);
+        }
+        close(pipefd[1]);
+
+        usleep(useconds_t(1000 + gen() % 50000));
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+
+        uint64_t acked = from, done;
+        while (read(pipefd[0], &done, sizeof(done)) == sizeof(done)) acked = done;
+        close(pipefd[0]);
+
+        wal_set w{PATH};
+        size_t k = recovered_ops(w, ops);
+        std::cerr << "round " << round << ": committed " << acked << " ops, recovered " << k << " ops\n";
+        if (k < acked || !check(w, ops, k)) {
+            std::cerr << "ERROR: recovered state does not match an op prefix covering all commits\n";
+            return 1;
+        }
+        from = k;
+    }
+
+    remove_files();
+    std::cout << "OK\n";
+    return 0;
+}